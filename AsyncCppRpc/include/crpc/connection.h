@@ -8,3 +8,4 @@
 
 #pragma once
 #include "impl/connection.h"
+#include "serializer.h"
@@ -0,0 +1,123 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "dependencies.h"
+#include "payload_pool.h"
+
+namespace crpc::details
+{
+	// Pending calls of a connection, keyed by call id. A call lives in the slot its id maps to; the slot state holds
+	// the id as a generation tag, so a stale or duplicate response cannot claim a newer call. Slots are claimed and
+	// released with a single compare-exchange. A call whose slot is still taken by an older call goes to an overflow map.
+	class completion_table
+	{
+	public:
+		using promise_t = corsl::promise<payload_t>;
+
+	private:
+		static constexpr const size_t capacity = 1024;
+		static constexpr const uint32_t call_id_mask = (1u << 30) - 1;
+
+		// slot states
+		static constexpr const uint32_t slot_free = 0;
+		static constexpr const uint32_t slot_busy = 1;
+
+		static constexpr uint32_t armed(uint32_t call_id) noexcept
+		{
+			return ((call_id & call_id_mask) << 2) | 2;
+		}
+
+		struct slot
+		{
+			std::atomic<uint32_t> state{ slot_free };
+			promise_t *promise{};
+		};
+
+		std::unique_ptr<slot[]> slots{ std::make_unique<slot[]>(capacity) };
+
+		corsl::srwlock overflow_lock;
+		std::map<uint32_t, promise_t *> overflow;
+		std::atomic<size_t> overflow_count{};
+
+		slot &slot_of(uint32_t call_id) const noexcept
+		{
+			return slots[call_id & (capacity - 1)];
+		}
+
+		// Moves the slot from `expected` to free and returns its promise
+		static promise_t *release(slot &s, uint32_t expected) noexcept
+		{
+			if (!s.state.compare_exchange_strong(expected, slot_busy, std::memory_order_acquire, std::memory_order_relaxed))
+				return nullptr;
+			auto *promise = s.promise;
+			s.state.store(slot_free, std::memory_order_release);
+			return promise;
+		}
+
+	public:
+		void add(uint32_t call_id, promise_t &promise)
+		{
+			auto &s = slot_of(call_id);
+			auto expected = slot_free;
+			if (s.state.compare_exchange_strong(expected, slot_busy, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				s.promise = &promise;
+				s.state.store(armed(call_id), std::memory_order_release);
+			}
+			else
+			{
+				std::scoped_lock l{ overflow_lock };
+				overflow.emplace(call_id & call_id_mask, &promise);
+				overflow_count.fetch_add(1, std::memory_order_release);
+			}
+		}
+
+		// Removes a pending call, returns nullptr if there is no such call
+		promise_t *take(uint32_t call_id) noexcept
+		{
+			if (auto *promise = release(slot_of(call_id), armed(call_id)))
+				return promise;
+
+			if (overflow_count.load(std::memory_order_acquire))
+			{
+				std::scoped_lock l{ overflow_lock };
+				if (auto it = overflow.find(call_id & call_id_mask); it != overflow.end())
+				{
+					auto *promise = it->second;
+					overflow.erase(it);
+					overflow_count.fetch_sub(1, std::memory_order_relaxed);
+					return promise;
+				}
+			}
+			return nullptr;
+		}
+
+		// Removes all pending calls, calling `f` for each of them
+		template<class F>
+		void take_all(F &&f)
+		{
+			for (size_t i = 0; i < capacity; ++i)
+			{
+				auto &s = slots[i];
+				if (const auto state = s.state.load(std::memory_order_relaxed); state != slot_free && state != slot_busy)
+				{
+					if (auto *promise = release(s, state))
+						f(*promise);
+				}
+			}
+
+			std::scoped_lock l{ overflow_lock };
+			for (auto &p : overflow)
+				f(*p.second);
+			overflow.clear();
+			overflow_count.store(0, std::memory_order_relaxed);
+		}
+	};
+}
@@ -9,6 +9,8 @@
 #pragma once
 #include "marshal.h"
 #include "transport.h"
+#include "write_queue.h"
+#include "completion_table.h"
 
 namespace crpc
 {
@@ -37,6 +39,79 @@ namespace crpc
 		template<class Trait>
 		using is_with_serializer_t = std::bool_constant<is_with_serializer<Trait>>;
 
+		// Lets the reader complete calls inline, resuming the awaiting coroutine on the reader thread instead of the background pool.
+		// Once `MaxInline` completions of a single read have run inline, or they have taken `BudgetMicroseconds` in total,
+		// the next completion goes through the background pool and counting starts over. Each read starts with a fresh budget.
+		template<unsigned MaxInline = 16, unsigned BudgetMicroseconds = 100>
+		struct with_inline_completion
+		{
+			struct is_with_inline_completion;
+			static constexpr const unsigned max_inline = MaxInline;
+			static constexpr const std::chrono::microseconds budget{ BudgetMicroseconds };
+		};
+
+		template<class Trait>
+		concept is_with_inline_completion = requires
+		{
+			typename Trait::is_with_inline_completion;
+		};
+
+		template<class Trait>
+		using is_with_inline_completion_t = std::bool_constant<is_with_inline_completion<Trait>>;
+
+		template<class TraitsList>
+		consteval auto get_inline_completion_helper()
+		{
+			using Completion = mp11::mp_filter<is_with_inline_completion_t, TraitsList>;
+			static_assert(mp11::mp_size<Completion>::value < 2, "You can either specify a single `with_inline_completion` trait, or none at all");
+			if constexpr (mp11::mp_size<Completion>::value == 1)
+				return wrapper<mp11::mp_front<Completion>>{};
+			else
+				return wrapper<with_inline_completion<0, 0>>{};
+		}
+
+		template<class TraitsList>
+		using get_inline_completion_t = typename decltype(get_inline_completion_helper<TraitsList>())::type;
+
+		// Decides whether the reader completes the next call inline
+		template<class Policy>
+		class completion_budget
+		{
+			unsigned count{};
+			std::chrono::steady_clock::duration spent{};
+
+		public:
+			// Called at the start of each read turn
+			void reset() noexcept
+			{
+				count = 0;
+				spent = {};
+			}
+
+			template<class F>
+			void complete(F &&f)
+			{
+				if constexpr (Policy::max_inline == 0)
+					f(std::false_type{});
+				else
+				{
+					if (count >= Policy::max_inline || spent >= Policy::budget)
+					{
+						count = 0;
+						spent = {};
+						f(std::false_type{});
+					}
+					else
+					{
+						++count;
+						const auto start = std::chrono::steady_clock::now();
+						f(std::true_type{});
+						spent += std::chrono::steady_clock::now() - start;
+					}
+				}
+			}
+		};
+
 		namespace validation
 		{
 			template<class M>
@@ -76,7 +151,7 @@ namespace crpc
 		}
 
 		template<class TraitsList>
-		using get_serializer_state = typename decltype(get_serializer_state_helper<TraitsList>())::type;
+		using get_serializer_state_t = typename decltype(get_serializer_state_helper<TraitsList>())::type;
 
 		template<class Connection>
 		struct resolver
@@ -97,11 +172,12 @@ namespace crpc
 		template<concepts::transport Transport, class... Traits>
 		class connection : 
 			public Inherit<ToMarshallers<MarshalHelpersOnly<mp11::mp_list<Traits...>>, connection<Transport, Traits...>>>,
-			public get_serializer_state<mp11::mp_list<Traits...>>
+			public get_serializer_state_t<mp11::mp_list<Traits...>>
 		{
 			// Validate passed marshaller types
 			using Marshallers = ToMarshallers<MarshalHelpersOnly<mp11::mp_list<Traits...>>, connection>;
-			using serializer_state = get_serializer_state<mp11::mp_list<Traits...>>;
+			using serializer_state = get_serializer_state_t<mp11::mp_list<Traits...>>;
+			using inline_completion = get_inline_completion_t<mp11::mp_list<Traits...>>;
 
 			static_assert(mp11::mp_size<Marshallers>::value == 1 || mp11::mp_size<Marshallers>::value == 2, "Supported configurations: client-only, server-only or both client and server");
 			static constexpr const auto clients_count = mp11::mp_count_if<Marshallers, validation::is_client>::value;
@@ -116,13 +192,17 @@ namespace crpc
 			static constexpr const bool reader_not_required = !has_server && has_only_void_methods<mp11::mp_first<Marshallers>>();
 			static constexpr const bool writer_not_required = clients_count == 0 && has_only_void_methods<mp11::mp_first<Marshallers>>();
 
+			// limits of a single batched transport write
+			static constexpr const size_t max_batch_count = 64;
+			static constexpr const size_t max_batch_bytes = 256 * 1024;
+
 			corsl::cancellation_source cancel;
 
 			std::optional<Transport> transport;
 
-			corsl::async_queue<message_t> write_queue;
-			std::map<uint32_t, corsl::promise<payload_t> *> completions;
-			mutable corsl::srwlock completions_lock, stop_lock;
+			details::write_queue write_queue;
+			completion_table completions;
+			mutable corsl::srwlock stop_lock;
 			corsl::future<> reader_task, writer_task;
 			
 			// error handling
@@ -158,6 +238,14 @@ namespace crpc
 				}
 			}
 
+			executor_ref get_executor() const noexcept
+			{
+				if constexpr (concepts::pinned_transport<Transport>)
+					return transport->get_executor();
+				else
+					return {};
+			}
+
 			corsl::future<> writer()
 			{
 				if constexpr (writer_not_required)
@@ -170,12 +258,38 @@ namespace crpc
 							write_queue.cancel();
 						} };
 
+					std::vector<message_t> batch;
 					while (!token.is_cancelled())
 					{
-						auto message = co_await write_queue.next();
 						try
 						{
-							co_await transport->write(std::move(message));
+							co_await write_queue.take(batch);
+							for (auto it = batch.begin(); it != batch.end();)
+							{
+								if constexpr (concepts::batch_transport<Transport>)
+								{
+									// a message that would take the batch over the byte limit starts the next one
+									auto end = std::next(it);
+									auto bytes = it->payload.size();
+									while (end != batch.end() && static_cast<size_t>(end - it) < max_batch_count && bytes + end->payload.size() <= max_batch_bytes)
+										bytes += (end++)->payload.size();
+
+									// a lone message keeps the plain write path
+									if (end - it == 1)
+										co_await transport->write(std::move(*it));
+									else
+										co_await transport->write_batch(std::span{ it, end });
+									it = end;
+								}
+								else
+									co_await transport->write(std::move(*it++));
+							}
+							batch.clear();
+						}
+						catch (const corsl::operation_cancelled &)
+						{
+							// the connection is being stopped, the error has already been reported
+							break;
 						}
 						catch (const corsl::hresult_error &e)
 						{
@@ -187,62 +301,109 @@ namespace crpc
 				}
 			}
 
-			corsl::future<> reader()
+			void on_message(message_t &message, std::atomic<std::int64_t> &outstanding_requests, corsl::promise<> &finished, completion_budget<inline_completion> &budget)
 			{
-				if constexpr (reader_not_required)
-					co_return;
+				if (message.type == call_type::response || message.type == call_type::response_error)
+				{
+					// this is a reply to a message we sent
+					if (auto promise = completions.take(message.call_id))
+					{
+						budget.complete([&](auto is_inline)
+							{
+								if (message.type == call_type::response_error) [[unlikely]]
+								{
+									HRESULT code = E_FAIL;
+									// written by send_error, independently of the serializer's encoding
+									if (message.payload.size() == sizeof(HRESULT))
+										memcpy(&code, message.payload.data(), sizeof(HRESULT));
+									auto error = std::make_exception_ptr(corsl::hresult_error{ code });
+									if constexpr (decltype(is_inline)::value)
+										promise->set_exception(std::move(error));
+									else
+										promise->set_exception_async(std::move(error));
+								}
+								else
+								{
+									if constexpr (decltype(is_inline)::value)
+										promise->set(std::move(message.payload));
+									else
+										promise->set_async(std::move(message.payload));
+								}
+							});
+					}
+				}
 				else
 				{
-					corsl::cancellation_token token{ co_await cancel };
-					// we will force the background thread in case data is already coming from the transport as this coroutine should return early
+					// this is a request from a client to server
+					execute_request(std::move(message), outstanding_requests, finished);
+				}
+			}
+
+			corsl::future<> read_loop(std::atomic<std::int64_t> &outstanding_requests, corsl::promise<> &finished)
+			{
+				corsl::cancellation_token token{ co_await cancel };
+				// we will force the background thread in case data is already coming from the transport as this coroutine should return early
+				if (auto executor = get_executor())
+					co_await details::resume_on(executor);
+				else
 					co_await corsl::resume_background();
 
-					std::atomic<std::int64_t> outstanding_requests{1};
-					corsl::promise<> finished;
+				completion_budget<inline_completion> budget;
 
-					while (!token.is_cancelled())
+				std::vector<message_t> batch;
+				while (!token.is_cancelled())
+				{
+					try
 					{
-						try
+						if constexpr (concepts::batch_read_transport<Transport>)
+						{
+							co_await transport->read_batch(batch);
+							budget.reset();
+							for (auto &message : batch)
+								on_message(message, outstanding_requests, finished, budget);
+							batch.clear();
+						}
+						else
 						{
 							auto message = co_await transport->read();
-							if (message.type == call_type::response || message.type == call_type::response_error)
-							{
-								// this is a reply to a message we sent
-								std::scoped_lock l{ completions_lock };
-								if (auto it = completions.find(message.call_id); it != completions.end())
-								{
-									auto promise = it->second;
-									completions.erase(it);
-									if (promise)
-									{
-										if (message.type == call_type::response_error) [[unlikely]]
-										{
-											if (message.payload.size() == sizeof(HRESULT))
-											{
-												HRESULT code;
-												Reader{ message.payload, get_serializer_state() } >> code;
-												promise->set_exception_async(std::make_exception_ptr(corsl::hresult_error{ code }));
-											}
-											else
-												promise->set_exception_async(std::make_exception_ptr(corsl::hresult_error{E_FAIL}));
-										}
-										else
-											promise->set_async(std::move(message.payload));
-									}
-								}
-							}
-							else
-							{
-								// this is a request from a client to server
-								execute_request(std::move(message), outstanding_requests, finished);
-							}
+							budget.reset();
+							on_message(message, outstanding_requests, finished, budget);
 						}
-						catch (const corsl::hresult_error &e)
+					}
+					catch (const corsl::hresult_error &e)
+					{
+						// unless the connection is being stopped, which cancels pending calls itself, their responses will not arrive
+						if (!cancel.is_cancelled())
 						{
 							cancel.cancel();
-							error_on_background(e.code(), captured_on::receive);
-							break;
+							completions.take_all([&](auto &promise)
+								{
+									promise.set_exception_async(std::make_exception_ptr(corsl::hresult_error{ e.code() }));
+								});
 						}
+						error_on_background(e.code(), captured_on::receive);
+						break;
+					}
+				}
+			}
+
+			corsl::future<> reader()
+			{
+				if constexpr (reader_not_required)
+					co_return;
+				else
+				{
+					std::atomic<std::int64_t> outstanding_requests{1};
+					corsl::promise<> finished;
+
+					std::exception_ptr error;
+					try
+					{
+						co_await read_loop(outstanding_requests, finished);
+					}
+					catch (...)
+					{
+						error = std::current_exception();
 					}
 
 					// We must ensure that reader_task exits only when all outstanding requests are completed (or cancelled)
@@ -250,62 +411,69 @@ namespace crpc
 					if (1 == outstanding_requests.fetch_sub(1, std::memory_order_relaxed))
 						finished.set();
 
-					// We cannot co_await now, cancellation could have already been requested
-					finished.get_future().wait();
+					// read_loop has bound the cancellation token, this coroutine has not, so it can wait without blocking a thread
+					co_await finished.get_future();
+
+					if (error)
+						std::rethrow_exception(error);
 				}
 			}
 
-			corsl::future<> execute_request(message_t message, std::atomic<std::int64_t> &outstanding_requests, corsl::promise<> &finished)
+			void send_error(const message_header &request, HRESULT hr)
 			{
-				HRESULT hr{};
-				bool pending{};
-				if constexpr (has_server)
+				if (!cancel.is_cancelled())
 				{
-					try
-					{
-						if (message.type == call_type::void_request)
-							this->void_dispatch(message.id, std::move(message.payload));
-						else
-						{
-							pending = true;
-							outstanding_requests.fetch_add(1, std::memory_order_release);
+					payload_t payload(sizeof(HRESULT));
+					memcpy(payload.data(), &hr, sizeof(HRESULT));
+					write_queue.push(message_t{ message_header{ request.call_id, call_type::response_error, request.id }, std::move(payload) });
+				}
+			}
 
-							corsl::cancellation_token token{ co_await cancel };
-							auto result = co_await this->dispatch(message.id, std::move(message.payload));
-							write_queue.push(message_t{ message_header{message.call_id, call_type::response, message.id }, std::move(result) });
-						}
-					}
-					catch (const corsl::hresult_error &e)
-					{
-						hr = e.code();
-					}
-					catch (...)
-					{
-						hr = E_FAIL;
-					}
+			// Sends the response to a single request and releases the request's hold on the reader
+			struct request_responder
+			{
+				connection *self;
+				message_header request;
+				std::atomic<std::int64_t> *outstanding_requests;
+				corsl::promise<> *finished;
+
+				void respond(payload_t payload) const
+				{
+					if (!self->cancel.is_cancelled())
+						self->write_queue.push(message_t{ message_header{ request.call_id, call_type::response, request.id }, std::move(payload) });
+					complete();
 				}
-				else
+
+				void fail(HRESULT hr) const
 				{
-					hr = E_INVALIDARG;
+					self->send_error(request, hr);
+					complete();
 				}
 
-				if (!cancel.is_cancelled())
+				void complete() const
 				{
-					// Error occurred, return error code to the caller, unless this is a void call
-					if (message.type != call_type::void_request)
-					{
-						message.payload.resize(sizeof(HRESULT));
-						memcpy(message.payload.data(), &hr, sizeof(HRESULT));
-						write_queue.push(message_t{ message_header{message.call_id, call_type::response_error, message.id}, std::move(message.payload) });
-					}
+					if (1 == outstanding_requests->fetch_sub(1, std::memory_order_relaxed))
+						finished->set();
 				}
+			};
 
-				if (pending)
+			void execute_request(message_t message, std::atomic<std::int64_t> &outstanding_requests, corsl::promise<> &finished)
+			{
+				if constexpr (has_server)
 				{
-					if (1 == outstanding_requests.fetch_sub(1, std::memory_order_relaxed))
-						finished.set();
+					if (message.type == call_type::void_request)
+					{
+						outstanding_requests.fetch_add(1, std::memory_order_release);
+						this->void_dispatch(message.id, std::move(message.payload), request_responder{ this, message, &outstanding_requests, &finished });
+					}
+					else if (!cancel.is_cancelled())
+					{
+						outstanding_requests.fetch_add(1, std::memory_order_release);
+						this->dispatch(message.id, std::move(message.payload), request_responder{ this, message, &outstanding_requests, &finished });
+					}
 				}
-				co_return;
+				else if (message.type != call_type::void_request)
+					send_error(message, E_INVALIDARG);
 			}
 
 		public:
@@ -315,7 +483,7 @@ namespace crpc
 			{}
 
 			template<class... Args>
-			connection(Transport &&transport, Args &&...args) requires !has_server :
+			connection(Transport &&transport, Args &&...args) requires (!has_server) :
 				serializer_state{ std::forward<Args>(args)... }
 			{
 				start(std::move(transport));
@@ -363,8 +531,12 @@ namespace crpc
 			void start(Transport &&transport_)
 			{
 				assert(!transport);
+				// a stopped connection keeps its cancelled source until it is restarted, so a racing call never sees it replaced
+				if (cancel.is_cancelled())
+					cancel = {};
 				transport.emplace(std::move(transport_));
 				transport->set_cancellation_token(cancel);
+				write_queue.set_executor(get_executor());
 
 				reader_task = reader();
 				writer_task = writer();
@@ -372,21 +544,41 @@ namespace crpc
 				running = true;
 			}
 
+			// Binds the client side of this connection directly to the implementation of `server`, a connection with a matching `server_of` trait
+			// in the same process. Calls then skip serialization, the transport and the reader and writer tasks. `server` must outlive the binding.
+			template<class Server>
+			void start_direct(Server &server)
+			{
+				static_assert(clients_count == 1, "Direct calls require a client connection");
+				assert(!transport);
+				if (cancel.is_cancelled())
+					cancel = {};
+				this->bind_direct(server.get_implementation());
+				std::scoped_lock l{ stop_lock };
+				running = true;
+			}
+
 			void stop()
 			{
 				if (std::scoped_lock l{ stop_lock }; running)
 				{
 					error_on_background(E_ABORT, captured_on::stop);
 					cancel.cancel();	// this will also prevent all future calls from being made through this connection
-					corsl::block_wait(corsl::when_all(std::move(writer_task), std::move(reader_task)));
+					if constexpr (clients_count != 0)
+						this->unbind_direct();
+					if (transport)
 					{
-						std::scoped_lock l2{ completions_lock };
-						for (auto &p : completions)
-							p.second->set_exception_async(std::make_exception_ptr(corsl::operation_cancelled{}));
-						completions.clear();
+						// calls and responses that race with stop are dropped from now on
+						write_queue.close();
+						corsl::block_wait(corsl::when_all(std::move(writer_task), std::move(reader_task)));
+						completions.take_all([](auto &promise)
+							{
+								promise.set_exception_async(std::make_exception_ptr(corsl::operation_cancelled{}));
+							});
+						transport.reset();
+						// a cancellation the writer has not consumed and messages queued before the close must not reach the next transport
+						write_queue.reset();
 					}
-					transport.reset();
-					cancel = {};
 					running = false;
 				}
 			}
@@ -395,15 +587,19 @@ namespace crpc
 			{
 				assert(transport);
 
-				corsl::cancellation_token token{ co_await cancel };
+				// the token is not bound: once registered, the promise must stay alive until whoever takes it from the table completes it
+				if (cancel.is_cancelled())
+					throw corsl::operation_cancelled{};
 
 				auto call_id = last_call_id.fetch_add(1, std::memory_order_relaxed);
 				corsl::promise<payload_t> promise;
-				{
-					std::scoped_lock l{ completions_lock };
-					completions.emplace(call_id, &promise);
-				}
-				write_queue.push(message_t{ message_header{call_id, call_type::request, name}, std::move(payload) });
+				completions.add(call_id, promise);
+				// the reader or stop may have failed pending calls before this one was registered
+				if (cancel.is_cancelled() && completions.take(call_id))
+					throw corsl::operation_cancelled{};
+				// a closed queue means stop is running: unless stop has already taken the promise, nobody will complete it
+				if (!write_queue.push(message_t{ message_header{call_id, call_type::request, name}, std::move(payload) }) && completions.take(call_id))
+					throw corsl::operation_cancelled{};
 				co_return co_await promise.get_future();
 			}
 
@@ -415,7 +611,8 @@ namespace crpc
 					throw corsl::operation_cancelled{};
 
 				auto call_id = last_call_id.fetch_add(1);
-				write_queue.push(message_t{ message_header{call_id, call_type::void_request, name}, std::move(payload) });
+				if (!write_queue.push(message_t{ message_header{call_id, call_type::void_request, name}, std::move(payload) }))
+					throw corsl::operation_cancelled{};
 			}
 
 			explicit operator bool() const noexcept
@@ -429,4 +626,5 @@ namespace crpc
 	using details::captured_on;
 	using details::connection;
 	using details::with_serializer_state;
+	using details::with_inline_completion;
 }
@@ -11,6 +11,16 @@
 #include <type_traits>
 #include <cassert>
 #include <expected>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
+#include <cstring>
 
 // boost.describe
 #include <boost/describe.hpp>
@@ -19,5 +29,14 @@
 #include <boost/mp11/algorithm.hpp>
 
 // corsl
+#if defined(_WIN32)
 #include <corsl/all.h>
+#else
+#include "posix/runtime.h"
+#endif
 
+#if defined(_MSC_VER)
+#define CRPC_NOVTABLE __declspec(novtable)
+#else
+#define CRPC_NOVTABLE
+#endif
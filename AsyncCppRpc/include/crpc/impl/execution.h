@@ -0,0 +1,169 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "dependencies.h"
+
+#include <condition_variable>
+#include <thread>
+
+namespace crpc
+{
+	namespace details
+	{
+		// HRESULT_FROM_WIN32(ERROR_BUSY), the result of a request rejected by a full executor
+		inline constexpr const HRESULT executor_busy = static_cast<HRESULT>(0x800700AA);
+
+		// Fixed set of threads running coroutines from a bounded queue. A request that finds the queue full is rejected
+		// with executor_busy, so the connection's reader never waits for the executor.
+		// The destructor stops accepting requests, lets the threads run what is already queued and joins them.
+		class bounded_executor
+		{
+			std::mutex lock;
+			std::condition_variable_any not_empty;
+			std::vector<std::coroutine_handle<>> queue;
+			size_t first{};
+			size_t count{};
+			bool stopping{};
+			std::vector<std::jthread> threads;
+
+			void run(std::stop_token stop)
+			{
+				while (true)
+				{
+					std::coroutine_handle<> h;
+					{
+						std::unique_lock l{ lock };
+						// once stopped, what is already queued still runs
+						if (!not_empty.wait(l, stop, [this] { return count != 0; }))
+							return;
+						h = queue[first];
+						first = (first + 1) % queue.size();
+						--count;
+					}
+					h.resume();
+				}
+			}
+
+		public:
+			bounded_executor(unsigned thread_count, size_t capacity) :
+				queue(std::max<size_t>(capacity, 1))
+			{
+				thread_count = std::max(thread_count, 1u);
+				threads.reserve(thread_count);
+				for (unsigned i = 0; i < thread_count; ++i)
+					threads.emplace_back([this](std::stop_token stop) { run(stop); });
+			}
+
+			bounded_executor(const bounded_executor &) = delete;
+			bounded_executor &operator =(const bounded_executor &) = delete;
+
+			~bounded_executor()
+			{
+				{
+					std::scoped_lock l{ lock };
+					stopping = true;
+				}
+				threads.clear();
+			}
+
+			// returns false if the queue is full or the executor is being destroyed
+			bool try_post(std::coroutine_handle<> h)
+			{
+				{
+					std::scoped_lock l{ lock };
+					if (stopping || count == queue.size())
+						return false;
+					queue[(first + count) % queue.size()] = h;
+					++count;
+				}
+				not_empty.notify_one();
+				return true;
+			}
+
+			auto schedule() noexcept
+			{
+				struct awaiter
+				{
+					bounded_executor &executor;
+					bool rejected{};
+
+					bool await_ready() const noexcept
+					{
+						return false;
+					}
+
+					bool await_suspend(std::coroutine_handle<> h)
+					{
+						rejected = !executor.try_post(h);
+						return !rejected;
+					}
+
+					void await_resume() const
+					{
+						if (rejected)
+							corsl::throw_error(executor_busy);
+					}
+				};
+
+				return awaiter{ *this };
+			}
+		};
+	}
+
+	// Where a server runs a method. A policy is passed as the second argument of crpc::method
+	namespace execution
+	{
+		using details::executor_busy;
+
+		// On the connection's reader thread (default)
+		struct inline_policy
+		{
+			static std::suspend_never schedule() noexcept
+			{
+				return {};
+			}
+		};
+
+		// On the shared background thread pool
+		struct pool_policy
+		{
+			static auto schedule() noexcept
+			{
+				return corsl::resume_background();
+			}
+		};
+
+		// On a dedicated executor with `Threads` threads and at most `Capacity` queued requests. Each instantiation owns
+		// one executor: methods share it only if they name the same `Name` with the same `Threads` and `Capacity`.
+		// Requests that find the queue full fail with executor_busy.
+		template<class Name, unsigned Threads = 1, size_t Capacity = 1024>
+		struct executor_policy
+		{
+			// A process-global singleton, never destroyed: a handler may still be running on one of its threads
+			// during process shutdown, and joining that thread from a static destructor could hang the exit
+			static details::bounded_executor &executor()
+			{
+				static auto *instance = new details::bounded_executor{ Threads, Capacity };
+				return *instance;
+			}
+
+			static auto schedule()
+			{
+				return executor().schedule();
+			}
+		};
+
+		template<class P>
+		concept policy = requires
+		{
+			P::schedule();
+		};
+	}
+}
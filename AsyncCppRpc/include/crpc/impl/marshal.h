@@ -10,6 +10,7 @@
 
 #include "serializer.h"
 #include "method_id.h"
+#include "execution.h"
 
 namespace crpc
 {
@@ -18,7 +19,7 @@ namespace crpc
 		template<typename T>
 		inline constexpr bool dependent_false = false;
 
-		template<class T>
+		template<class T, execution::policy Policy = execution::inline_policy>
 		struct method;
 
 		template<class T>
@@ -47,9 +48,9 @@ namespace crpc
 		inline consteval auto get_storage_type()
 		{
 			if constexpr (is_span<T>::value)
-				return wrapper<std::vector<T>>{};
+				return wrapper<std::vector<std::remove_cv_t<typename T::element_type>>>{};
 			else if constexpr (is_string_view<T>::value)
-				return wrapper<std::basic_string<typename T::value_type>>{};
+				return wrapper<std::basic_string<typename T::value_type, typename T::traits_type>>{};
 			else
 				return wrapper<T>{};
 		}
@@ -57,18 +58,103 @@ namespace crpc
 		template<class T>
 		using to_storage_type = typename decltype(get_storage_type<T>())::type;
 
-		template<class R, class...Args>
-		struct method<R(Args...)> : std::move_only_function<R(Args...)>
+		// On the server, read-only views of trivially copyable elements borrow from the request payload when the
+		// serialization format stores them as-is, see Reader::read(borrowed_view)
+		template<class T>
+		inline consteval auto get_received_type()
+		{
+			if constexpr (is_string_view<T>::value)
+				return wrapper<borrowed_view<T>>{};
+			else if constexpr (is_span<T>::value)
+			{
+				using element_type = typename T::element_type;
+				if constexpr (T::extent == std::dynamic_extent && std::is_const_v<element_type> && std::is_trivially_copyable_v<element_type>)
+					return wrapper<borrowed_view<T>>{};
+				else
+					return get_storage_type<T>();
+			}
+			else
+				return wrapper<T>{};
+		}
+
+		template<class T>
+		using to_received_type = typename decltype(get_received_type<T>())::type;
+
+		template<class Arg, class P>
+		inline to_storage_type<Arg> store_argument(P &&p)
+		{
+			if constexpr (is_span<Arg>::value)
+			{
+				const Arg view = p;
+				return to_storage_type<Arg>(view.begin(), view.end());
+			}
+			else
+				return to_storage_type<Arg>(std::forward<P>(p));
+		}
+
+		template<class...Args>
+		struct method_arguments
+		{
+			using stored_t = std::tuple<to_storage_type<std::decay_t<Args>>...>;
+			using received_t = std::tuple<to_received_type<std::decay_t<Args>>...>;
+
+			template<class...P>
+			static stored_t store(P &&...p)
+			{
+				return { store_argument<std::decay_t<Args>>(std::forward<P>(p))... };
+			}
+		};
+
+		template<class R, class...Args, class Policy>
+		struct method<R(Args...), Policy> : std::move_only_function<R(Args...)>
 		{
 			struct is_method_test;
 
 			using result_type = R;
-			using stored_args_t = mp11::mp_transform<to_storage_type, std::tuple<std::decay_t<Args>...>>;
+			using execution_policy = Policy;
+			using arguments = method_arguments<Args...>;
+			// the function the client side installs
+			using client_function = std::move_only_function<R(Args...)>;
 			static constexpr const size_t args_count = sizeof...(Args);
 
 			using std::move_only_function<R(Args...)>::move_only_function;
 		};
 
+		template<class F, class...Args>
+		concept returns_future = std::is_invocable_v<F &, Args...> && corsl::is_future_v<std::invoke_result_t<F &, Args...>>;
+
+		// A method the server implements synchronously. The server runs it inline on the reader thread,
+		// callers still receive a future.
+		template<class R, class...Args, class Policy>
+			requires (!std::same_as<R, void> && !corsl::is_future_v<R>)
+		struct method<R(Args...), Policy> : std::move_only_function<corsl::future<R>(Args...)>
+		{
+			struct is_method_test;
+			struct is_sync_method;
+
+			using result_type = corsl::future<R>;
+			using execution_policy = Policy;
+			using arguments = method_arguments<Args...>;
+			using client_function = std::move_only_function<corsl::future<R>(Args...)>;
+			static constexpr const size_t args_count = sizeof...(Args);
+
+			// server-side implementation
+			std::move_only_function<R(Args...)> handler;
+
+			method() = default;
+
+			template<class F>
+				requires (std::is_invocable_r_v<R, F &, Args...> && !returns_future<F, Args...>)
+			method(F &&f) :
+				handler{ std::forward<F>(f) }
+			{}
+
+			// The implementation of a method declared as returning R must return R, not a future
+			template<class F>
+				requires returns_future<F, Args...>
+			method(F &&) = delete;
+		};
+
 		template<class T>
 		concept method_descriptor = requires
 		{
@@ -90,6 +176,15 @@ namespace crpc
 		template<class MD>
 		using is_void_method = std::bool_constant<std::same_as<void, typename MD::result_type>>;
 
+		template<class T>
+		concept sync_method = requires
+		{
+			typename T::is_sync_method;
+		};
+
+		template<class MD>
+		concept runs_inline = std::same_as<typename MD::execution_policy, execution::inline_policy>;
+
 		template<class Derived, class Interface>
 		class marshal_client : public Interface
 		{
@@ -368,6 +463,91 @@ namespace crpc
 			using methods = boost::describe::describe_members<Interface, boost::describe::mod_public>;
 			static_assert(mp11::mp_size<methods>::value >= 1, "Interface must contain at least one method");
 
+			std::atomic<Interface *> direct{};
+
+			// Arguments are copied into storage owned by the call, just as if they had been deserialized on the server side.
+			// The method runs where its execution policy says, as it does when called through a transport.
+			template<class M, class...P>
+			static auto direct_call(Interface &target, P &&...p) -> typename get_method_descriptor<M>::result_type
+			{
+				using Member = get_method_descriptor<M>;
+				auto args = Member::arguments::store(std::forward<P>(p)...);
+				if constexpr (std::same_as<typename Member::result_type, void>)
+				{
+					if constexpr (runs_inline<Member>)
+						direct_invoke_void<M>(target, args);
+					else
+						direct_schedule_void<M>(target, std::move(args));
+				}
+				else
+					return direct_invoke<M>(target, std::move(args));
+			}
+
+			// fire-and-forget calls do not report errors
+			template<class M, class Args>
+			static void direct_invoke_void(Interface &target, Args &args) noexcept
+			{
+				try
+				{
+					std::apply(target.*M::pointer, std::move(args));
+				}
+				catch (...)
+				{
+				}
+			}
+
+			template<class M, class Args>
+			static corsl::fire_and_forget direct_schedule_void(Interface &target, Args args)
+			{
+				try
+				{
+					co_await get_method_descriptor<M>::execution_policy::schedule();
+				}
+				catch (const corsl::hresult_error &)
+				{
+					// rejected by the executor
+					co_return;
+				}
+				direct_invoke_void<M>(target, args);
+			}
+
+			template<class M, class Args>
+			static auto direct_invoke(Interface &target, Args args) -> typename get_method_descriptor<M>::result_type
+			{
+				using R = typename get_method_descriptor<M>::result_type::result_type;
+				try
+				{
+					co_await get_method_descriptor<M>::execution_policy::schedule();
+
+					if constexpr (sync_method<get_method_descriptor<M>>)
+						co_return std::apply((target.*M::pointer).handler, std::move(args));
+					else if constexpr (std::same_as<R, void>)
+						co_await std::apply(target.*M::pointer, std::move(args));
+					else
+						co_return co_await std::apply(target.*M::pointer, std::move(args));
+				}
+				catch (const corsl::hresult_error &)
+				{
+					throw;
+				}
+				catch (...)
+				{
+					corsl::throw_error(E_FAIL);
+				}
+			}
+
+			template<class M>
+			auto build_member(method_id name)
+			{
+				using Member = get_method_descriptor<M>;
+				return [this, call = build_call_member<Member>(name)]<typename...P>(P &&...p) -> typename Member::result_type
+				{
+					if (auto *target = direct.load(std::memory_order_acquire))
+						return direct_call<M>(*target, std::forward<P>(p)...);
+					return call(std::forward<P>(p)...);
+				};
+			}
+
 		public:
 			struct is_client_marshaller;
 			static constexpr const bool only_void_methods = mp11::mp_all_of<
@@ -378,10 +558,20 @@ namespace crpc
 				auto *pT = static_cast<Interface *>(this);
 				mp11::mp_for_each<methods>([&]<typename M>(M)
 				{
-					using Member = std::decay_t<decltype(pT->*M::pointer)>;
-					pT->*M::pointer = build_call_member<Member>(get_method_id<M>());
+					static_cast<typename get_method_descriptor<M>::client_function &>(pT->*M::pointer) = build_member<M>(get_method_id<M>());
 				});
 			}
+
+			// While bound, calls go straight to the target implementation, bypassing serialization and the transport
+			void bind_direct(Interface &target) noexcept
+			{
+				direct.store(&target, std::memory_order_release);
+			}
+
+			void unbind_direct() noexcept
+			{
+				direct.store(nullptr, std::memory_order_release);
+			}
 		};
 
 		struct method_map_entry
@@ -423,76 +613,192 @@ namespace crpc
 				return static_cast<Derived *>(this)->get_serializer_state();
 			}
 
-		protected:
-			corsl::future<payload_t> dispatch(method_id name, std::vector<std::byte> data)
+			// Arguments may borrow from the request payload, in which case it cannot be reused for the response
+			template<class Member, class R>
+			payload_t serialize_result(payload_t &&data, const R &result)
 			{
-				if (auto it = sr::lower_bound(static_method_map, name, sr::less{}, [](const auto& e) { return e.name; }); it != static_method_map.end() && it->name == name)
+				using arguments = typename Member::arguments;
+				if constexpr (std::same_as<typename arguments::received_t, typename arguments::stored_t>)
 				{
-					co_return co_await mp11::mp_with_index<mp11::mp_size<Methods>::value>(static_cast<size_t>(it->ordinal), [&]<typename I>(I) -> corsl::future<payload_t>
-					{
-						using M = mp11::mp_at<Methods, I>;
-						using Member = std::decay_t<decltype(implementation.*M::pointer)>;
-						using FR = typename Member::result_type;
-						static_assert(valid_return<FR>, "Interface method return type must be a future or void");
-						typename Member::stored_args_t tuple;
-						Reader{ data, get_state() } >> tuple;
+					data.clear();
+					return create_writer_on_with_state(std::move(data), get_state(), result).get();
+				}
+				else
+					return create_writer_with_state(get_state(), result).get();
+			}
 
-						constexpr bool is_void = std::same_as<FR, void>;
+			// The only coroutine frame of a request. When the method runs inline and its future is already complete,
+			// the response is sent before dispatch returns.
+			template<class M, class Responder>
+			corsl::fire_and_forget execute(payload_t data, Responder responder)
+			{
+				using Member = get_method_descriptor<M>;
+				using FR = typename Member::result_type;
 
-						if constexpr (!is_void)
-						{
-							using R = typename FR::result_type;
-							constexpr bool is_future_void = std::same_as<R, void>;
+				HRESULT hr{};
+				try
+				{
+					co_await Member::execution_policy::schedule();
 
-							if constexpr (is_future_void)
-							{
-								co_await std::apply(implementation.*M::pointer, std::move(tuple));
-								co_return payload_t{};
-							}
-							else
-							{
-								data.clear();
-								auto result = co_await std::apply(implementation.*M::pointer, std::move(tuple));
-								co_return create_writer_on_with_state(std::move(data), get_state(), result).get();
-							}
+					typename Member::arguments::received_t tuple;
+					Reader{ data, get_state() } >> tuple;
+
+					if constexpr (sync_method<Member>)
+					{
+						auto result = std::apply((implementation.*M::pointer).handler, std::move(tuple));
+						data = serialize_result<Member>(std::move(data), result);
+					}
+					else if constexpr (!std::same_as<FR, void>)
+					{
+						if constexpr (std::same_as<typename FR::result_type, void>)
+						{
+							co_await std::apply(implementation.*M::pointer, std::move(tuple));
+							data.clear();
 						}
 						else
 						{
-							co_return payload_t{};
+							auto result = co_await std::apply(implementation.*M::pointer, std::move(tuple));
+							data = serialize_result<Member>(std::move(data), result);
 						}
-					});
+					}
+					else
+						data.clear();
+				}
+				catch (const corsl::hresult_error &e)
+				{
+					hr = e.code();
+				}
+				catch (...)
+				{
+					hr = E_FAIL;
+				}
+
+				if (hr)
+					responder.fail(hr);
+				else
+					responder.respond(std::move(data));
+			}
+
+			// Synchronous methods running on the reader need no coroutine
+			template<class M, class Responder>
+			void execute_inline(payload_t data, const Responder &responder)
+			{
+				using Member = get_method_descriptor<M>;
+
+				HRESULT hr{};
+				try
+				{
+					typename Member::arguments::received_t tuple;
+					Reader{ data, get_state() } >> tuple;
+
+					auto result = std::apply((implementation.*M::pointer).handler, std::move(tuple));
+					data = serialize_result<Member>(std::move(data), result);
+				}
+				catch (const corsl::hresult_error &e)
+				{
+					hr = e.code();
 				}
+				catch (...)
+				{
+					hr = E_FAIL;
+				}
+
+				if (hr)
+					responder.fail(hr);
 				else
+					responder.respond(std::move(data));
+			}
+
+			// fire-and-forget calls do not report errors
+			template<class M>
+			void invoke_void(const payload_t &data) noexcept
+			{
+				using Member = get_method_descriptor<M>;
+				try
+				{
+					typename Member::arguments::received_t tuple;
+					Reader{ data, get_state() } >> tuple;
+
+					std::apply(implementation.*M::pointer, std::move(tuple));
+				}
+				catch (...)
 				{
-					corsl::throw_error(E_NOTIMPL);
 				}
 			}
 
-			void void_dispatch(method_id name, std::vector<std::byte> data)
+			template<class M, class Responder>
+			corsl::fire_and_forget execute_void(payload_t data, Responder responder)
+			{
+				bool scheduled = true;
+				try
+				{
+					co_await get_method_descriptor<M>::execution_policy::schedule();
+				}
+				catch (const corsl::hresult_error &)
+				{
+					// rejected by the executor, fire-and-forget calls do not report errors
+					scheduled = false;
+				}
+				if (scheduled)
+					invoke_void<M>(data);
+				responder.complete();
+			}
+
+			template<class F>
+			static bool with_method(method_id name, F &&f)
 			{
 				if (auto it = sr::lower_bound(static_method_map, name, sr::less{}, [](const auto& e) { return e.name; }); it != static_method_map.end() && it->name == name)
 				{
 					mp11::mp_with_index<mp11::mp_size<Methods>::value>(static_cast<size_t>(it->ordinal), [&]<typename I>(I)
 					{
 						using M = mp11::mp_at<Methods, I>;
-						using Member = std::decay_t<decltype(implementation.*M::pointer)>;
-						using FR = typename Member::result_type;
-						static_assert(valid_return<FR>, "Interface method return type must be a future or void");
-						constexpr bool is_void = std::same_as<FR, void>;
-
-						if constexpr (is_void)
-						{
-							typename Member::stored_args_t tuple;
-							Reader{ data, get_state() } >> tuple;
-
-							std::apply(implementation.*M::pointer, std::move(tuple));
-						}
+						static_assert(valid_return<typename get_method_descriptor<M>::result_type>, "Interface method return type must be a future or void");
+						f(M{});
 					});
+					return true;
 				}
 				else
+					return false;
+			}
+
+		protected:
+			// Starts a request. `responder.respond(payload)` or `responder.fail(hr)` is called exactly once
+			template<class Responder>
+			void dispatch(method_id name, payload_t data, Responder responder)
+			{
+				const bool found = with_method(name, [&]<typename M>(M)
 				{
-					corsl::throw_error(E_NOTIMPL);
-				}
+					if constexpr (sync_method<get_method_descriptor<M>> && runs_inline<get_method_descriptor<M>>)
+						execute_inline<M>(std::move(data), responder);
+					else
+						execute<M>(std::move(data), std::move(responder));
+				});
+
+				if (!found)
+					responder.fail(E_NOTIMPL);
+			}
+
+			// Starts a fire-and-forget request. `responder.complete()` is called once the method has run
+			template<class Responder>
+			void void_dispatch(method_id name, payload_t data, Responder responder)
+			{
+				bool started{};
+				with_method(name, [&]<typename M>(M)
+				{
+					if constexpr (is_void_method<get_method_descriptor<M>>::value)
+					{
+						if constexpr (runs_inline<get_method_descriptor<M>>)
+							invoke_void<M>(data);
+						else
+						{
+							execute_void<M>(std::move(data), std::move(responder));
+							started = true;
+						}
+					}
+				});
+
+				if (!started)
+					responder.complete();
 			}
 
 		public:
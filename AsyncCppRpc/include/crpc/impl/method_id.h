@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include "payload_pool.h"
+
 namespace crpc::details
 {
 	struct method_id
@@ -35,8 +37,6 @@ namespace crpc::details
 		constexpr bool operator==(const method_id &) const = default;
 	};
 
-	using payload_t = std::vector<std::byte>;
-
 	namespace fnv
 	{
 		template<class Char>
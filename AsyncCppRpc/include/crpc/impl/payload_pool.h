@@ -0,0 +1,215 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace crpc::details
+{
+	// Size-classed payload buffer pool. Each thread keeps a small cache of free blocks per size class
+	// and exchanges half of it with a shared depot when it runs empty or full, so buffers allocated
+	// on a reader thread and released on a worker thread keep circulating instead of going back to the heap.
+	class payload_pool
+	{
+		static constexpr const size_t min_class_shift = 6;		// 64 bytes
+		static constexpr const size_t max_class_shift = 18;	// 256 KiB
+		static constexpr const size_t class_count = max_class_shift - min_class_shift + 1;
+		static constexpr const size_t cache_bytes = size_t{ 2 } << 20;
+		static constexpr const size_t depot_factor = 8;
+
+		static constexpr size_t class_of(size_t size) noexcept
+		{
+			return size <= (size_t{ 1 } << min_class_shift) ? 0 : std::bit_width(size - 1) - min_class_shift;
+		}
+
+		static constexpr size_t class_size(size_t c) noexcept
+		{
+			return size_t{ 1 } << (c + min_class_shift);
+		}
+
+		static constexpr size_t cache_limit(size_t c) noexcept
+		{
+			return std::clamp<size_t>(cache_bytes / class_size(c), 2, 128);
+		}
+
+		struct depot
+		{
+			std::mutex lock;
+			std::vector<void *> blocks;
+		};
+
+		depot depots[class_count];
+
+		payload_pool()
+		{
+			for (size_t c = 0; c < class_count; ++c)
+				depots[c].blocks.reserve(cache_limit(c) * depot_factor);
+		}
+
+		// Never destroyed: thread caches may flush into it during process shutdown
+		static payload_pool &instance()
+		{
+			static payload_pool *pool = new payload_pool;
+			return *pool;
+		}
+
+		void refill(size_t c, std::vector<void *> &local) noexcept
+		{
+			auto &d = depots[c];
+			std::lock_guard lock{ d.lock };
+			const auto count = std::min(d.blocks.size(), cache_limit(c) / 2);
+			local.insert(local.end(), d.blocks.end() - count, d.blocks.end());
+			d.blocks.resize(d.blocks.size() - count);
+		}
+
+		void drain(size_t c, std::vector<void *> &local, size_t count) noexcept
+		{
+			auto &d = depots[c];
+			{
+				std::lock_guard lock{ d.lock };
+				while (count && d.blocks.size() < d.blocks.capacity())
+				{
+					d.blocks.push_back(local.back());
+					local.pop_back();
+					--count;
+				}
+			}
+			for (; count; --count)
+			{
+				::operator delete(local.back());
+				local.pop_back();
+			}
+		}
+
+		struct thread_cache
+		{
+			std::vector<void *> blocks[class_count];
+
+			thread_cache()
+			{
+				for (size_t c = 0; c < class_count; ++c)
+					blocks[c].reserve(cache_limit(c));
+			}
+
+			~thread_cache()
+			{
+				exited() = true;
+				for (size_t c = 0; c < class_count; ++c)
+					instance().drain(c, blocks[c], blocks[c].size());
+			}
+		};
+
+		static bool &exited() noexcept
+		{
+			thread_local bool value{};
+			return value;
+		}
+
+		static thread_cache &local()
+		{
+			thread_local thread_cache cache;
+			return cache;
+		}
+
+	public:
+		[[nodiscard]]
+		static void *allocate(size_t size)
+		{
+			const auto c = class_of(size);
+			if (c >= class_count)
+				return ::operator new(size);
+			// A block allocated here may be released on a live thread into the class cache, so it must be full-sized
+			if (exited())
+				return ::operator new(class_size(c));
+
+			auto &blocks = local().blocks[c];
+			if (blocks.empty())
+				instance().refill(c, blocks);
+			if (blocks.empty())
+				return ::operator new(class_size(c));
+
+			auto *block = blocks.back();
+			blocks.pop_back();
+			return block;
+		}
+
+		static void deallocate(void *block, size_t size) noexcept
+		{
+			const auto c = class_of(size);
+			if (c >= class_count || exited())
+			{
+				::operator delete(block);
+				return;
+			}
+
+			auto &blocks = local().blocks[c];
+			if (blocks.size() == blocks.capacity())
+				instance().drain(c, blocks, blocks.size() / 2);
+			blocks.push_back(block);
+		}
+	};
+
+	// Instances of derived types (and coroutine frames, when used as a promise base) are allocated from payload_pool
+	struct pooled_object
+	{
+		static void *operator new(size_t size)
+		{
+			return payload_pool::allocate(size);
+		}
+
+		static void operator delete(void *p, size_t size) noexcept
+		{
+			payload_pool::deallocate(p, size);
+		}
+	};
+
+	// Allocates from payload_pool. Elements are default-initialized, so sizing a payload
+	// before reading into it does not zero-fill the buffer first.
+	template<class T>
+	struct pooled_allocator
+	{
+		using value_type = T;
+		using is_always_equal = std::true_type;
+
+		pooled_allocator() = default;
+
+		template<class U>
+		constexpr pooled_allocator(const pooled_allocator<U> &) noexcept
+		{}
+
+		[[nodiscard]]
+		T *allocate(size_t n)
+		{
+			return static_cast<T *>(payload_pool::allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, size_t n) noexcept
+		{
+			payload_pool::deallocate(p, n * sizeof(T));
+		}
+
+		template<class U>
+		void construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>)
+		{
+			::new (static_cast<void *>(p)) U;
+		}
+
+		template<class U>
+		constexpr bool operator ==(const pooled_allocator<U> &) const noexcept
+		{
+			return true;
+		}
+	};
+
+	using payload_t = std::vector<std::byte, pooled_allocator<std::byte>>;
+}
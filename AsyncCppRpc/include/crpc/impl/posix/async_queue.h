@@ -0,0 +1,109 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "error.h"
+#include "executor.h"
+
+#include <coroutine>
+#include <mutex>
+#include <optional>
+
+namespace crpc::posix
+{
+	// Multi-producer, single-consumer queue with an awaitable `next`
+	template<class T>
+	class async_queue
+	{
+		std::mutex lock;
+		ring_buffer<T> items;
+		std::coroutine_handle<> waiter;
+		// a cancellation is delivered to exactly one call to `next`
+		bool cancelled{};
+
+		// must be called under lock
+		bool try_take(std::optional<T> &item)
+		{
+			if (cancelled)
+				return true;
+			if (items.size())
+			{
+				items.pop(item.emplace());
+				return true;
+			}
+			return false;
+		}
+
+	public:
+		async_queue() = default;
+		async_queue(const async_queue &) = delete;
+		async_queue &operator =(const async_queue &) = delete;
+
+		void push(T value)
+		{
+			std::coroutine_handle<> h;
+			{
+				std::scoped_lock l{ lock };
+				items.push(std::move(value));
+				h = std::exchange(waiter, {});
+			}
+			if (h)
+				background_pool().post(h);
+		}
+
+		void cancel()
+		{
+			std::coroutine_handle<> h;
+			{
+				std::scoped_lock l{ lock };
+				cancelled = true;
+				h = std::exchange(waiter, {});
+			}
+			if (h)
+				background_pool().post(h);
+		}
+
+		auto next()
+		{
+			struct awaiter
+			{
+				async_queue &queue;
+				std::optional<T> item;
+
+				bool await_ready()
+				{
+					std::scoped_lock l{ queue.lock };
+					return queue.try_take(item);
+				}
+
+				bool await_suspend(std::coroutine_handle<> h)
+				{
+					std::scoped_lock l{ queue.lock };
+					if (queue.try_take(item))
+						return false;
+					queue.waiter = h;
+					return true;
+				}
+
+				T await_resume()
+				{
+					if (!item)
+					{
+						std::scoped_lock l{ queue.lock };
+						if (std::exchange(queue.cancelled, false) || !queue.try_take(item))
+							throw operation_cancelled{};
+					}
+					return std::move(*item);
+				}
+			};
+
+			return awaiter{ *this, std::nullopt };
+		}
+	};
+}
@@ -0,0 +1,247 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "error.h"
+
+#include <atomic>
+#include <coroutine>
+#include <memory>
+#include <mutex>
+
+namespace crpc::posix
+{
+	class cancellation_source;
+	class cancellation_token;
+
+	namespace impl
+	{
+		struct subscription_node
+		{
+			subscription_node *prev{}, *next{};
+			void (*invoke)(subscription_node *) noexcept {};
+			bool linked{};
+		};
+
+		class cancellation_state
+		{
+			std::atomic<bool> cancelled{};
+			// callbacks are invoked under the lock; a recursive mutex lets them unsubscribe or subscribe themselves
+			std::recursive_mutex lock;
+			subscription_node *head{};
+			std::shared_ptr<cancellation_state> parent;
+
+			struct parent_link : subscription_node
+			{
+				cancellation_state *self;
+			} parent_node{};
+
+		public:
+			cancellation_state() = default;
+
+			explicit cancellation_state(std::shared_ptr<cancellation_state> parent_) :
+				parent{ std::move(parent_) }
+			{
+				parent_node.self = this;
+				parent_node.invoke = [](subscription_node *node) noexcept
+				{
+					static_cast<parent_link *>(node)->self->cancel();
+				};
+				if (!parent->subscribe(&parent_node))
+					cancelled.store(true, std::memory_order_release);
+			}
+
+			cancellation_state(const cancellation_state &) = delete;
+			cancellation_state &operator =(const cancellation_state &) = delete;
+
+			~cancellation_state()
+			{
+				if (parent)
+					parent->unsubscribe(&parent_node);
+			}
+
+			bool is_cancelled() const noexcept
+			{
+				return cancelled.load(std::memory_order_acquire);
+			}
+
+			void cancel() noexcept
+			{
+				std::scoped_lock l{ lock };
+				if (cancelled.exchange(true, std::memory_order_acq_rel))
+					return;
+				while (auto *node = head)
+				{
+					head = node->next;
+					if (head)
+						head->prev = nullptr;
+					node->linked = false;
+					node->invoke(node);
+				}
+			}
+
+			// returns false if the state has already been cancelled, in which case the node is not linked
+			bool subscribe(subscription_node *node) noexcept
+			{
+				std::scoped_lock l{ lock };
+				if (is_cancelled())
+					return false;
+				node->prev = nullptr;
+				node->next = head;
+				if (head)
+					head->prev = node;
+				head = node;
+				node->linked = true;
+				return true;
+			}
+
+			void unsubscribe(subscription_node *node) noexcept
+			{
+				std::scoped_lock l{ lock };
+				if (node->linked)
+				{
+					if (node->prev)
+						node->prev->next = node->next;
+					else
+						head = node->next;
+					if (node->next)
+						node->next->prev = node->prev;
+					node->linked = false;
+				}
+			}
+		};
+
+		using cancellation_state_ptr = std::shared_ptr<cancellation_state>;
+	}
+
+	class cancellation_token
+	{
+		friend class cancellation_source;
+		template<class F>
+		friend class cancellation_subscription;
+
+		impl::cancellation_state_ptr state;
+
+	public:
+		cancellation_token() = default;
+		explicit cancellation_token(impl::cancellation_state_ptr state) noexcept :
+			state{ std::move(state) }
+		{}
+
+		bool is_cancelled() const noexcept
+		{
+			return state && state->is_cancelled();
+		}
+
+		void check_cancelled() const
+		{
+			if (is_cancelled())
+				throw operation_cancelled{};
+		}
+
+		const impl::cancellation_state_ptr &get_state() const noexcept
+		{
+			return state;
+		}
+	};
+
+	class cancellation_source
+	{
+		impl::cancellation_state_ptr state{ std::make_shared<impl::cancellation_state>() };
+
+		explicit cancellation_source(impl::cancellation_state_ptr state) noexcept :
+			state{ std::move(state) }
+		{}
+
+	public:
+		cancellation_source() = default;
+
+		void cancel() const noexcept
+		{
+			state->cancel();
+		}
+
+		bool is_cancelled() const noexcept
+		{
+			return state->is_cancelled();
+		}
+
+		cancellation_token get_token() const noexcept
+		{
+			return cancellation_token{ state };
+		}
+
+		// The returned source is cancelled when this source is cancelled, but not vice versa
+		cancellation_source create_connected_source() const
+		{
+			return cancellation_source{ std::make_shared<impl::cancellation_state>(state) };
+		}
+
+		// co_await source produces a token. Inside crpc::posix::future coroutines the token also becomes bound to the coroutine, see future.h
+		auto operator co_await() const noexcept
+		{
+			struct awaiter
+			{
+				impl::cancellation_state_ptr state;
+
+				bool await_ready() const noexcept
+				{
+					return true;
+				}
+
+				void await_suspend(std::coroutine_handle<>) const noexcept
+				{}
+
+				cancellation_token await_resume() noexcept
+				{
+					return cancellation_token{ std::move(state) };
+				}
+			};
+
+			return awaiter{ state };
+		}
+	};
+
+	// Invokes a callback when the token is cancelled. If the token has already been cancelled, the callback is invoked immediately.
+	// Unsubscribes on destruction and, if the callback is running on another thread, waits for it to complete.
+	template<class F>
+	class cancellation_subscription : impl::subscription_node
+	{
+		impl::cancellation_state_ptr state;
+		F callback;
+
+	public:
+		cancellation_subscription(const cancellation_token &token, F callback_) :
+			state{ token.state },
+			callback{ std::move(callback_) }
+		{
+			if (state)
+			{
+				invoke = [](impl::subscription_node *node) noexcept
+				{
+					static_cast<cancellation_subscription *>(node)->callback();
+				};
+				if (!state->subscribe(this))
+					callback();
+			}
+		}
+
+		cancellation_subscription(const cancellation_subscription &) = delete;
+		cancellation_subscription &operator =(const cancellation_subscription &) = delete;
+
+		~cancellation_subscription()
+		{
+			if (state)
+				state->unsubscribe(this);
+		}
+	};
+
+	template<class F>
+	cancellation_subscription(const cancellation_token &, F) -> cancellation_subscription<F>;
+}
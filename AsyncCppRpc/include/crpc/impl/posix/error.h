@@ -0,0 +1,119 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#include <string>
+
+// The library reports errors as HRESULT codes on every platform. These are the codes it uses itself.
+using HRESULT = int32_t;
+
+inline constexpr HRESULT S_OK = 0;
+inline constexpr HRESULT E_NOTIMPL = static_cast<HRESULT>(0x80004001);
+inline constexpr HRESULT E_ABORT = static_cast<HRESULT>(0x80004004);
+inline constexpr HRESULT E_FAIL = static_cast<HRESULT>(0x80004005);
+inline constexpr HRESULT E_OUTOFMEMORY = static_cast<HRESULT>(0x8007000E);
+inline constexpr HRESULT E_INVALIDARG = static_cast<HRESULT>(0x80070057);
+
+namespace crpc::posix
+{
+	// errno values are wrapped the same way Win32 error codes are wrapped by HRESULT_FROM_WIN32
+	inline constexpr HRESULT hresult_from_errno(int error) noexcept
+	{
+		return error <= 0 ? static_cast<HRESULT>(error) : static_cast<HRESULT>((static_cast<uint32_t>(error) & 0x0000FFFF) | 0x80070000);
+	}
+
+	inline constexpr HRESULT error_cancelled = static_cast<HRESULT>(0x800704C7);
+
+	class hresult_error : public std::exception
+	{
+		HRESULT hr;
+
+	public:
+		hresult_error() noexcept :
+			hr{ E_FAIL }
+		{}
+
+		explicit hresult_error(HRESULT hr) noexcept :
+			hr{ hr }
+		{}
+
+		HRESULT code() const noexcept
+		{
+			return hr;
+		}
+
+		std::string message() const
+		{
+			switch (hr)
+			{
+			case E_NOTIMPL:
+				return "Not implemented";
+			case E_ABORT:
+				return "Operation aborted";
+			case E_FAIL:
+				return "Unspecified error";
+			case E_INVALIDARG:
+				return "The parameter is incorrect";
+			case error_cancelled:
+				return "The operation was canceled";
+			default:
+				if ((static_cast<uint32_t>(hr) & 0xFFFF0000) == 0x80070000)
+					return std::strerror(static_cast<int>(hr & 0xFFFF));
+				return "Unknown error";
+			}
+		}
+
+		const char *what() const noexcept override
+		{
+			return "crpc::posix::hresult_error";
+		}
+	};
+
+	struct operation_cancelled : hresult_error
+	{
+		operation_cancelled() noexcept :
+			hresult_error{ error_cancelled }
+		{}
+	};
+
+	[[noreturn]]
+	inline void throw_error(HRESULT hr)
+	{
+		if (hr == error_cancelled)
+			throw operation_cancelled{};
+		throw hresult_error{ hr };
+	}
+
+	[[noreturn]]
+	inline void throw_errno(int error)
+	{
+		if (error == ECANCELED)
+			throw operation_cancelled{};
+		throw hresult_error{ hresult_from_errno(error) };
+	}
+
+	[[noreturn]]
+	inline void throw_last_error()
+	{
+		throw_errno(errno);
+	}
+
+	// Throws if a POSIX call returned -1
+	template<class T>
+	inline T check_posix_api(T result)
+	{
+		if (result == static_cast<T>(-1))
+			throw_last_error();
+		return result;
+	}
+}
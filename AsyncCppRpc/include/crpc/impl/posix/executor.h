@@ -0,0 +1,663 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "error.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace crpc::posix
+{
+	using task_t = std::move_only_function<void()>;
+
+	namespace concepts
+	{
+		template<class E>
+		concept executor = requires(E & e, std::coroutine_handle<> h)
+		{
+			e.post(h);
+		};
+	}
+
+	inline unsigned default_concurrency() noexcept
+	{
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Ring buffer, its size is a power of two. Unlike std::deque, it does not allocate once it has grown large enough.
+	// `pop` takes the oldest item, `pop_back` the newest.
+	template<class T>
+	class ring_buffer
+	{
+		std::vector<T> items{ 64 };
+		size_t head{}, count{};
+
+		void grow()
+		{
+			std::vector<T> bigger(items.size() * 2);
+			for (size_t i = 0; i < count; ++i)
+				bigger[i] = std::move(items[(head + i) & (items.size() - 1)]);
+			items.swap(bigger);
+			head = 0;
+		}
+
+	public:
+		void push(T item)
+		{
+			if (count == items.size())
+				grow();
+			items[(head + count) & (items.size() - 1)] = std::move(item);
+			++count;
+		}
+
+		bool pop(T &item)
+		{
+			if (!count)
+				return false;
+			item = std::move(items[head]);
+			head = (head + 1) & (items.size() - 1);
+			--count;
+			return true;
+		}
+
+		bool pop_back(T &item)
+		{
+			if (!count)
+				return false;
+			--count;
+			item = std::move(items[(head + count) & (items.size() - 1)]);
+			return true;
+		}
+
+		size_t size() const noexcept
+		{
+			return count;
+		}
+	};
+
+	struct thread_pool_stats
+	{
+		// tasks currently queued on each worker
+		std::vector<size_t> queue_depths;
+		// tasks a worker took from another worker's queue
+		uint64_t steals{};
+		uint64_t executed{};
+	};
+
+	// A work-stealing pool. This is the "background" executor. Each worker has its own queue: tasks posted from a worker
+	// go to that worker's queue, tasks posted from other threads are spread over the queues round-robin.
+	// A worker runs the newest task of its own queue first, while its data is still in cache. An idle worker takes
+	// the oldest task from a randomly chosen victim before going to sleep.
+	class thread_pool
+	{
+	public:
+		// after this many tasks taken from the back, the owner takes one from the front, so old tasks are not starved
+		static constexpr const unsigned max_lifo_streak = 16;
+
+	private:
+		struct alignas(64) worker_queue
+		{
+			std::mutex lock;
+			ring_buffer<task_t> tasks;
+			unsigned lifo_streak{};
+			std::atomic<size_t> depth{};
+			std::atomic<uint64_t> steals{};
+			std::atomic<uint64_t> executed{};
+		};
+
+		std::vector<std::unique_ptr<worker_queue>> queues;
+		std::atomic<uint32_t> next_queue{};
+
+		// number of tasks queued in all queues, sleeping workers wait for it to become non-zero
+		std::atomic<size_t> queued{};
+		std::atomic<unsigned> sleepers{};
+		std::mutex sleep_lock;
+		std::condition_variable cv;
+		std::atomic<bool> stopping{};
+
+		std::vector<std::jthread> workers;
+
+		// Stands in for a worker blocked in block_on. A spare goes back to `idle_spares` when the wait is over, so block_on
+		// creates a thread only when every spare is busy.
+		struct spare_thread
+		{
+			std::mutex lock;
+			std::condition_variable cv;
+			// the queue to serve, or empty while the spare is idle
+			std::optional<size_t> index;
+			std::atomic<bool> done{};
+			bool exit{};
+			std::jthread thread;
+		};
+
+		std::mutex spares_lock;
+		std::vector<std::unique_ptr<spare_thread>> spares;
+		std::vector<spare_thread *> idle_spares;
+
+		struct worker_context
+		{
+			thread_pool *pool{};
+			size_t index{};
+		};
+
+		static worker_context &current() noexcept
+		{
+			static thread_local worker_context context;
+			return context;
+		}
+
+		bool try_pop_own(worker_queue &q, task_t &task)
+		{
+			std::scoped_lock l{ q.lock };
+			const bool lifo = ++q.lifo_streak <= max_lifo_streak;
+			if (!lifo)
+				q.lifo_streak = 0;
+			if (!(lifo ? q.tasks.pop_back(task) : q.tasks.pop(task)))
+				return false;
+			q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+			queued.fetch_sub(1);
+			return true;
+		}
+
+		bool try_steal(worker_queue &q, task_t &task)
+		{
+			std::scoped_lock l{ q.lock };
+			if (!q.tasks.pop(task))
+				return false;
+			q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+			queued.fetch_sub(1);
+			return true;
+		}
+
+		bool steal(size_t self, uint32_t &seed, task_t &task)
+		{
+			// xorshift
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			const auto count = queues.size();
+			const auto start = seed % count;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const auto victim = (start + i) % count;
+				if (victim != self && queues[victim]->depth.load(std::memory_order_relaxed) && try_steal(*queues[victim], task))
+				{
+					queues[self]->steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Runs tasks from queue `index`, or stolen from other queues, until `exit` returns true
+		template<class Exit>
+		void serve(size_t index, Exit &&exit)
+		{
+			current() = { this, index };
+			auto &own = *queues[index];
+			uint32_t seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+
+			while (!exit())
+			{
+				task_t task;
+				if (try_pop_own(own, task) || steal(index, seed, task))
+				{
+					task();
+					own.executed.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+
+				std::unique_lock l{ sleep_lock };
+				sleepers.fetch_add(1);
+				cv.wait(l, [&] { return stopping || queued.load() || exit(); });
+				sleepers.fetch_sub(1);
+			}
+		}
+
+		void worker_proc(size_t index)
+		{
+			serve(index, [this] { return stopping && !queued.load(); });
+		}
+
+		void spare_proc(spare_thread &spare)
+		{
+			for (;;)
+			{
+				size_t index;
+				{
+					std::unique_lock l{ spare.lock };
+					spare.cv.wait(l, [&] { return spare.index || spare.exit; });
+					if (!spare.index)
+						return;
+					index = *spare.index;
+				}
+
+				serve(index, [&] { return spare.done.load(); });
+
+				{
+					std::scoped_lock l{ spare.lock };
+					spare.index.reset();
+				}
+				std::scoped_lock l{ spares_lock };
+				idle_spares.push_back(&spare);
+			}
+		}
+
+		spare_thread &take_spare()
+		{
+			std::scoped_lock l{ spares_lock };
+			if (!idle_spares.empty())
+			{
+				auto *spare = idle_spares.back();
+				idle_spares.pop_back();
+				return *spare;
+			}
+
+			auto &spare = *spares.emplace_back(std::make_unique<spare_thread>());
+			spare.thread = std::jthread{ [this, &spare] { spare_proc(spare); } };
+			return spare;
+		}
+
+	public:
+		explicit thread_pool(unsigned count = default_concurrency())
+		{
+			count = std::max(count, 1u);
+			queues.reserve(count);
+			for (unsigned i = 0; i < count; ++i)
+				queues.emplace_back(std::make_unique<worker_queue>());
+
+			workers.reserve(count);
+			for (unsigned i = 0; i < count; ++i)
+				workers.emplace_back([this, i] { worker_proc(i); });
+		}
+
+		thread_pool(const thread_pool &) = delete;
+		thread_pool &operator =(const thread_pool &) = delete;
+
+		~thread_pool()
+		{
+			{
+				std::scoped_lock l{ sleep_lock };
+				stopping = true;
+			}
+			cv.notify_all();
+			workers.clear();
+
+			for (auto &spare : spares)
+			{
+				{
+					std::scoped_lock l{ spare->lock };
+					spare->exit = true;
+				}
+				spare->cv.notify_one();
+			}
+			spares.clear();
+		}
+
+		void post(task_t task)
+		{
+			const auto &context = current();
+			auto &q = context.pool == this ?
+				*queues[context.index] :
+				*queues[next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+			{
+				std::scoped_lock l{ q.lock };
+				q.tasks.push(std::move(task));
+				q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+			}
+
+			// pairs with a worker announcing itself in `sleepers` before checking `queued`
+			queued.fetch_add(1);
+			if (sleepers.load())
+			{
+				std::scoped_lock l{ sleep_lock };
+				cv.notify_one();
+			}
+		}
+
+		void post(std::coroutine_handle<> h)
+		{
+			post(task_t{ [h] { h.resume(); } });
+		}
+
+		// Calls `wait`, which blocks the calling thread. If the caller is a worker of this pool, a spare thread serves
+		// its queue until `wait` returns, so the tasks being waited for run even when every worker is blocked.
+		template<class Wait>
+		void block_on(Wait &&wait)
+		{
+			const auto context = current();
+			if (context.pool != this)
+				return wait();
+
+			auto &spare = take_spare();
+			{
+				std::scoped_lock l{ spare.lock };
+				spare.done = false;
+				spare.index = context.index;
+			}
+			spare.cv.notify_one();
+
+			wait();
+			{
+				std::scoped_lock l{ sleep_lock };
+				spare.done = true;
+			}
+			cv.notify_all();
+		}
+
+		size_t size() const noexcept
+		{
+			return workers.size();
+		}
+
+		thread_pool_stats stats() const
+		{
+			thread_pool_stats result;
+			result.queue_depths.reserve(queues.size());
+			for (const auto &q : queues)
+			{
+				result.queue_depths.push_back(q->depth.load(std::memory_order_relaxed));
+				result.steals += q->steals.load(std::memory_order_relaxed);
+				result.executed += q->executed.load(std::memory_order_relaxed);
+			}
+			return result;
+		}
+	};
+
+	// A pool thread that blocks in block_wait is replaced for the duration of the wait (see thread_pool::block_on), so the pool
+	// has one thread per CPU. It is intentionally leaked: like the system thread pool on Windows, it is torn down by process exit.
+	inline thread_pool &background_pool()
+	{
+		static thread_pool *pool = new thread_pool{ default_concurrency() };
+		return *pool;
+	}
+
+	// Receives readiness notifications for a descriptor registered with an event_loop
+	struct io_handler
+	{
+		virtual ~io_handler() = default;
+		virtual void on_io(uint32_t events) noexcept = 0;
+	};
+
+	// A single-threaded epoll reactor with an eventfd-driven task queue
+	class event_loop
+	{
+		static constexpr const int max_events = 64;
+
+		int epoll{ -1 };
+		int wakeup{ -1 };
+		std::mutex lock;
+		std::vector<task_t> pending, running;
+		std::atomic<bool> stopping{};
+		std::thread::id owner;
+
+		static event_loop *&current_slot() noexcept
+		{
+			static thread_local event_loop *current{};
+			return current;
+		}
+
+		void signal() noexcept
+		{
+			const uint64_t one = 1;
+			[[maybe_unused]] auto r = ::write(wakeup, &one, sizeof(one));
+		}
+
+		void drain_wakeup() noexcept
+		{
+			uint64_t value;
+			[[maybe_unused]] auto r = ::read(wakeup, &value, sizeof(value));
+		}
+
+		void run_pending()
+		{
+			{
+				std::scoped_lock l{ lock };
+				running.swap(pending);
+			}
+			for (auto &task : running)
+				task();
+			running.clear();
+		}
+
+	public:
+		event_loop() :
+			epoll{ check_posix_api(::epoll_create1(EPOLL_CLOEXEC)) },
+			wakeup{ check_posix_api(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) }
+		{
+			epoll_event ev{ .events = EPOLLIN, .data = { .ptr = nullptr } };
+			check_posix_api(::epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &ev));
+		}
+
+		event_loop(const event_loop &) = delete;
+		event_loop &operator =(const event_loop &) = delete;
+
+		~event_loop()
+		{
+			::close(wakeup);
+			::close(epoll);
+		}
+
+		static event_loop *current() noexcept
+		{
+			return current_slot();
+		}
+
+		bool is_current() const noexcept
+		{
+			return current_slot() == this;
+		}
+
+		void post(task_t task)
+		{
+			bool was_empty;
+			{
+				std::scoped_lock l{ lock };
+				was_empty = pending.empty();
+				pending.push_back(std::move(task));
+			}
+			if (was_empty)
+				signal();
+		}
+
+		void post(std::coroutine_handle<> h)
+		{
+			post(task_t{ [h] { h.resume(); } });
+		}
+
+		// handler must stay alive until the matching remove call
+		void add(int fd, uint32_t events, io_handler *handler)
+		{
+			epoll_event ev{ .events = events, .data = { .ptr = handler } };
+			check_posix_api(::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev));
+		}
+
+		void modify(int fd, uint32_t events, io_handler *handler)
+		{
+			epoll_event ev{ .events = events, .data = { .ptr = handler } };
+			check_posix_api(::epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &ev));
+		}
+
+		// Unregisters the descriptor. Events for it may already have been retrieved by the loop thread,
+		// so the handler is kept alive until the loop has finished dispatching the current batch.
+		void remove(int fd, std::shared_ptr<io_handler> keep_alive) noexcept
+		{
+			::epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+			if (keep_alive)
+				post(task_t{ [h = std::move(keep_alive)] {} });
+		}
+
+		void run()
+		{
+			current_slot() = this;
+			epoll_event events[max_events];
+			while (!stopping.load(std::memory_order_acquire))
+			{
+				const auto count = ::epoll_wait(epoll, events, max_events, -1);
+				if (count < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw_last_error();
+				}
+
+				for (int i = 0; i < count; ++i)
+				{
+					if (auto *handler = static_cast<io_handler *>(events[i].data.ptr))
+						handler->on_io(events[i].events);
+					else
+						drain_wakeup();
+				}
+				run_pending();
+			}
+			current_slot() = nullptr;
+		}
+
+		void stop() noexcept
+		{
+			stopping.store(true, std::memory_order_release);
+			signal();
+		}
+	};
+
+	// One event loop thread per core. Descriptors are spread over loops round-robin.
+	class reactor_pool
+	{
+		std::vector<std::unique_ptr<event_loop>> loops;
+		std::vector<std::jthread> threads;
+		std::atomic<uint32_t> next_loop{};
+
+	public:
+		explicit reactor_pool(unsigned count = default_concurrency())
+		{
+			loops.reserve(count);
+			threads.reserve(count);
+			for (unsigned i = 0; i < count; ++i)
+				loops.emplace_back(std::make_unique<event_loop>());
+			for (auto &loop : loops)
+				threads.emplace_back([l = loop.get()] { l->run(); });
+		}
+
+		reactor_pool(const reactor_pool &) = delete;
+		reactor_pool &operator =(const reactor_pool &) = delete;
+
+		~reactor_pool()
+		{
+			for (auto &loop : loops)
+				loop->stop();
+			threads.clear();
+		}
+
+		event_loop &pick() noexcept
+		{
+			return *loops[next_loop.fetch_add(1, std::memory_order_relaxed) % loops.size()];
+		}
+
+		event_loop &operator[](size_t index) noexcept
+		{
+			return *loops[index];
+		}
+
+		// Binds each loop thread to its own CPU, picked from the CPUs the process may run on
+		void pin_threads()
+		{
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+				return;
+
+			std::vector<int> cpus;
+			for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+				if (CPU_ISSET(cpu, &allowed))
+					cpus.push_back(cpu);
+			if (cpus.empty())
+				return;
+
+			for (size_t i = 0; i < loops.size(); ++i)
+			{
+				loops[i]->post(task_t{ [cpu = cpus[i % cpus.size()]]
+					{
+						cpu_set_t set;
+						CPU_ZERO(&set);
+						CPU_SET(cpu, &set);
+						::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+					} });
+			}
+		}
+
+		size_t size() const noexcept
+		{
+			return loops.size();
+		}
+	};
+
+	inline reactor_pool &reactors()
+	{
+		static reactor_pool *pool = new reactor_pool{};
+		return *pool;
+	}
+
+	// Reactors for thread-per-core servers, each thread bound to its own CPU. They are separate from `reactors()`,
+	// so sockets spread over the shared reactors are not confined to single CPUs.
+	inline reactor_pool &per_core_reactors()
+	{
+		static reactor_pool *pool = []
+		{
+			auto *result = new reactor_pool{};
+			result->pin_threads();
+			return result;
+		}();
+		return *pool;
+	}
+
+	template<concepts::executor Executor>
+	inline auto resume_on(Executor &executor) noexcept
+	{
+		struct awaiter
+		{
+			Executor &executor;
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				executor.post(h);
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		return awaiter{ executor };
+	}
+
+	inline auto resume_background()
+	{
+		return resume_on(background_pool());
+	}
+}
@@ -0,0 +1,554 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "error.h"
+#include "executor.h"
+#include "cancel.h"
+#include "../payload_pool.h"
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace crpc::posix
+{
+	template<class T = void>
+	class future;
+
+	template<class T = void>
+	class promise;
+
+	namespace impl
+	{
+		template<class T>
+		class result_holder
+		{
+			std::variant<std::monostate, T, std::exception_ptr> result;
+
+		public:
+			template<class V>
+			void set_value(V &&v)
+			{
+				result.template emplace<1>(std::forward<V>(v));
+			}
+
+			void set_exception(std::exception_ptr e) noexcept
+			{
+				result.template emplace<2>(std::move(e));
+			}
+
+			T get()
+			{
+				if (result.index() == 2)
+					std::rethrow_exception(std::get<2>(result));
+				assert(result.index() == 1);
+				return std::move(std::get<1>(result));
+			}
+		};
+
+		template<>
+		class result_holder<void>
+		{
+			std::exception_ptr exception;
+
+		public:
+			void set_value() noexcept
+			{}
+
+			void set_exception(std::exception_ptr e) noexcept
+			{
+				exception = std::move(e);
+			}
+
+			void get()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+			}
+		};
+
+		// Shared state of a future. Reference-counted by the producer (a coroutine frame or a promise) and the future.
+		template<class T>
+		class future_state : public result_holder<T>
+		{
+			static constexpr const std::uintptr_t no_waiter = 0;
+			static constexpr const std::uintptr_t ready = 1;
+
+			std::atomic<uint32_t> refs;
+			// no_waiter, ready or the address of the awaiting coroutine
+			std::atomic<std::uintptr_t> waiter{ no_waiter };
+
+		protected:
+			virtual void destroy() noexcept = 0;
+
+		public:
+			explicit future_state(uint32_t initial_refs) noexcept :
+				refs{ initial_refs }
+			{}
+
+			void add_ref() noexcept
+			{
+				refs.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void release() noexcept
+			{
+				if (1 == refs.fetch_sub(1, std::memory_order_acq_rel))
+					destroy();
+			}
+
+			bool is_ready() const noexcept
+			{
+				return waiter.load(std::memory_order_acquire) == ready;
+			}
+
+			// returns false if the state is already completed
+			bool set_continuation(std::coroutine_handle<> h) noexcept
+			{
+				auto expected = no_waiter;
+				return waiter.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(h.address()), std::memory_order_acq_rel, std::memory_order_acquire);
+			}
+
+			void wait() const noexcept
+			{
+				for (auto v = waiter.load(std::memory_order_acquire); v != ready; v = waiter.load(std::memory_order_acquire))
+					waiter.wait(v, std::memory_order_acquire);
+			}
+
+			// Marks the state completed and returns the continuation to resume, if any.
+			// The caller must hold a reference until this returns.
+			std::coroutine_handle<> complete() noexcept
+			{
+				const auto prev = waiter.exchange(ready, std::memory_order_acq_rel);
+				waiter.notify_all();
+				assert(prev != ready && "future completed twice");
+				if (prev != no_waiter && prev != ready)
+					return std::coroutine_handle<>::from_address(reinterpret_cast<void *>(prev));
+				else
+					return {};
+			}
+
+			void complete_inline() noexcept
+			{
+				if (auto h = complete())
+					h.resume();
+			}
+
+			void complete_async()
+			{
+				if (auto h = complete())
+					background_pool().post(h);
+			}
+		};
+
+		template<class T>
+		class heap_state final : public future_state<T>, public details::pooled_object
+		{
+			void destroy() noexcept override
+			{
+				delete this;
+			}
+
+		public:
+			heap_state() noexcept :
+				future_state<T>{ 1 }
+			{}
+		};
+
+		template<class A>
+		concept has_member_co_await = requires(A && a)
+		{
+			std::forward<A>(a).operator co_await();
+		};
+
+		template<class A>
+		concept has_free_co_await = requires(A && a)
+		{
+			operator co_await(std::forward<A>(a));
+		};
+
+		template<class A>
+		inline decltype(auto) get_awaiter(A &&a)
+		{
+			if constexpr (has_member_co_await<A>)
+				return std::forward<A>(a).operator co_await();
+			else if constexpr (has_free_co_await<A>)
+				return operator co_await(std::forward<A>(a));
+			else
+				return std::forward<A>(a);
+		}
+
+		// Once a coroutine obtains a token with `co_await source`, its subsequent co_await expressions throw
+		// operation_cancelled instead of suspending if the source has been cancelled
+		template<class Awaiter>
+		struct cancellable_awaiter
+		{
+			Awaiter awaiter;
+			const cancellation_state *state;
+
+			bool await_ready()
+			{
+				if (state && state->is_cancelled())
+					return true;
+				return awaiter.await_ready();
+			}
+
+			template<class Promise>
+			auto await_suspend(std::coroutine_handle<Promise> h)
+			{
+				return awaiter.await_suspend(h);
+			}
+
+			decltype(auto) await_resume()
+			{
+				if (state && state->is_cancelled())
+					throw operation_cancelled{};
+				return awaiter.await_resume();
+			}
+		};
+
+		// Completes the state, then drops the frame's reference and transfers control to the continuation
+		struct final_awaiter
+		{
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			template<class Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+			{
+				auto &self = h.promise();
+				auto continuation = self.complete();
+				// the frame may be destroyed here
+				self.release();
+				return continuation ? continuation : std::noop_coroutine();
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		template<class T>
+		class coroutine_promise_base : public future_state<T>, public details::pooled_object
+		{
+			cancellation_state_ptr bound_token;
+
+		public:
+			coroutine_promise_base() noexcept :
+				future_state<T>{ 2 }
+			{}
+
+			future<T> get_return_object() noexcept
+			{
+				return future<T>{ this };
+			}
+
+			std::suspend_never initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			final_awaiter final_suspend() noexcept
+			{
+				return {};
+			}
+
+			void unhandled_exception() noexcept
+			{
+				this->set_exception(std::current_exception());
+			}
+
+			auto await_transform(const cancellation_source &source) noexcept
+			{
+				auto token = source.get_token();
+				bound_token = token.get_state();
+
+				struct awaiter
+				{
+					cancellation_token token;
+
+					bool await_ready() const noexcept
+					{
+						return true;
+					}
+
+					void await_suspend(std::coroutine_handle<>) const noexcept
+					{}
+
+					cancellation_token await_resume() noexcept
+					{
+						return std::move(token);
+					}
+				};
+
+				return awaiter{ std::move(token) };
+			}
+
+			// a non-const source would otherwise match this overload and the token would not be bound
+			template<class A>
+				requires (!std::same_as<std::remove_cvref_t<A>, cancellation_source>)
+			auto await_transform(A &&a)
+			{
+				using Awaiter = decltype(get_awaiter(std::forward<A>(a)));
+				return cancellable_awaiter<Awaiter>{ get_awaiter(std::forward<A>(a)), bound_token.get() };
+			}
+		};
+
+		template<class T>
+		struct coroutine_promise final : coroutine_promise_base<T>
+		{
+			void destroy() noexcept override
+			{
+				std::coroutine_handle<coroutine_promise>::from_promise(*this).destroy();
+			}
+
+			template<class V>
+			void return_value(V &&v)
+			{
+				this->set_value(std::forward<V>(v));
+			}
+		};
+
+		template<>
+		struct coroutine_promise<void> final : coroutine_promise_base<void>
+		{
+			void destroy() noexcept override
+			{
+				std::coroutine_handle<coroutine_promise>::from_promise(*this).destroy();
+			}
+
+			void return_void() noexcept
+			{}
+		};
+
+		template<class T>
+		struct is_future : std::false_type
+		{};
+
+		template<class T>
+		struct is_future<future<T>> : std::true_type
+		{};
+	}
+
+	template<class T>
+	inline constexpr bool is_future_v = impl::is_future<T>::value;
+
+	// An eagerly started, single-consumer future
+	template<class T>
+	class future
+	{
+		template<class>
+		friend class promise;
+		friend class impl::coroutine_promise_base<T>;
+
+		impl::future_state<T> *state{};
+
+		explicit future(impl::future_state<T> *state) noexcept :
+			state{ state }
+		{}
+
+	public:
+		using result_type = T;
+		using promise_type = impl::coroutine_promise<T>;
+
+		future() = default;
+
+		future(future &&o) noexcept :
+			state{ std::exchange(o.state, nullptr) }
+		{}
+
+		future &operator =(future &&o) noexcept
+		{
+			if (this != &o)
+			{
+				if (state)
+					state->release();
+				state = std::exchange(o.state, nullptr);
+			}
+			return *this;
+		}
+
+		~future()
+		{
+			if (state)
+				state->release();
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return state != nullptr;
+		}
+
+		bool is_ready() const noexcept
+		{
+			return state->is_ready();
+		}
+
+		void wait() const noexcept
+		{
+			state->wait();
+		}
+
+		T get()
+		{
+			state->wait();
+			return state->get();
+		}
+
+		auto operator co_await() const noexcept
+		{
+			struct awaiter
+			{
+				impl::future_state<T> *state;
+
+				bool await_ready() const noexcept
+				{
+					return state->is_ready();
+				}
+
+				bool await_suspend(std::coroutine_handle<> h) noexcept
+				{
+					return state->set_continuation(h);
+				}
+
+				T await_resume()
+				{
+					return state->get();
+				}
+			};
+
+			return awaiter{ state };
+		}
+	};
+
+	// A promise not bound to a coroutine. set* methods resume the awaiting coroutine inline, set*_async on the background pool.
+	template<class T>
+	class promise
+	{
+		impl::future_state<T> *state{ new impl::heap_state<T> };
+		bool completed{};
+
+		template<class F>
+		void complete(F &&f, bool async)
+		{
+			assert(!completed);
+			completed = true;
+			f();
+			if (async)
+				state->complete_async();
+			else
+				state->complete_inline();
+		}
+
+	public:
+		promise() = default;
+
+		promise(promise &&o) noexcept :
+			state{ std::exchange(o.state, nullptr) },
+			completed{ o.completed }
+		{}
+
+		promise &operator =(promise &&o) = delete;
+
+		~promise()
+		{
+			if (state)
+			{
+				if (!completed)
+					set_exception(std::make_exception_ptr(operation_cancelled{}));
+				state->release();
+			}
+		}
+
+		future<T> get_future() noexcept
+		{
+			state->add_ref();
+			return future<T>{ state };
+		}
+
+		template<class... V>
+		void set(V &&...v)
+		{
+			complete([&] { state->set_value(std::forward<V>(v)...); }, false);
+		}
+
+		template<class... V>
+		void set_async(V &&...v)
+		{
+			complete([&] { state->set_value(std::forward<V>(v)...); }, true);
+		}
+
+		void set_exception(std::exception_ptr e)
+		{
+			complete([&] { state->set_exception(std::move(e)); }, false);
+		}
+
+		void set_exception_async(std::exception_ptr e)
+		{
+			complete([&] { state->set_exception(std::move(e)); }, true);
+		}
+	};
+
+	struct fire_and_forget
+	{
+		struct promise_type : details::pooled_object
+		{
+			fire_and_forget get_return_object() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never final_suspend() const noexcept
+			{
+				return {};
+			}
+
+			void return_void() const noexcept
+			{}
+
+			void unhandled_exception() const noexcept
+			{
+				std::terminate();
+			}
+		};
+	};
+
+	template<class... T>
+	inline future<> when_all(future<T>... futures) requires (std::is_void_v<T> && ...)
+	{
+		(co_await std::move(futures), ...);
+	}
+
+	template<class... T>
+	inline future<std::tuple<T...>> when_all(future<T>... futures) requires (!std::is_void_v<T> && ...)
+	{
+		co_return std::tuple<T...>{ co_await std::move(futures)... };
+	}
+
+	// Must not be called on a reactor thread: the reactor would stop dispatching I/O while it waits.
+	template<class T>
+	inline T block_wait(future<T> &&f)
+	{
+		assert(!event_loop::current() && "block_wait on a reactor thread");
+		background_pool().block_on([&] { f.wait(); });
+		return f.get();
+	}
+}
@@ -0,0 +1,72 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "error.h"
+
+#include <utility>
+
+#include <sys/mman.h>
+
+namespace crpc::posix::impl
+{
+	class mapping
+	{
+		void *address{ MAP_FAILED };
+		size_t length{};
+
+	public:
+		mapping() = default;
+		mapping(void *address, size_t length) noexcept :
+			address{ address },
+			length{ length }
+		{}
+
+		// anonymous, page-aligned memory
+		explicit mapping(size_t length) :
+			mapping{ ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), length }
+		{
+			if (address == MAP_FAILED)
+				throw_last_error();
+		}
+
+		mapping(mapping &&o) noexcept :
+			address{ std::exchange(o.address, MAP_FAILED) },
+			length{ std::exchange(o.length, 0) }
+		{}
+
+		mapping &operator =(mapping &&o) noexcept
+		{
+			if (this != &o)
+			{
+				this->~mapping();
+				address = std::exchange(o.address, MAP_FAILED);
+				length = std::exchange(o.length, 0);
+			}
+			return *this;
+		}
+
+		~mapping()
+		{
+			if (address != MAP_FAILED)
+				::munmap(address, length);
+		}
+
+		template<class T = std::byte>
+		T *at(size_t offset = 0) const noexcept
+		{
+			return reinterpret_cast<T *>(static_cast<std::byte *>(address) + offset);
+		}
+
+		size_t size() const noexcept
+		{
+			return length;
+		}
+	};
+}
@@ -0,0 +1,22 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+// Portable implementation of the part of the corsl API used by the library. It is built on plain C++20 coroutines,
+// a background thread pool and epoll/eventfd reactors.
+
+#include "error.h"
+#include "sync.h"
+#include "executor.h"
+#include "cancel.h"
+#include "future.h"
+#include "async_queue.h"
+
+// The library is written against the corsl API. On POSIX systems the same names are provided by crpc::posix.
+namespace corsl = crpc::posix;
@@ -0,0 +1,620 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "mapping.h"
+#include "unix_transport.h"
+
+#include <bit>
+#include <thread>
+
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace crpc
+{
+	namespace details::shm
+	{
+		struct shm_config
+		{
+			// Path of the AF_UNIX socket used to hand over the shared memory, see unix_config
+			std::string path;
+			// Capacity of each of the two rings, rounded up to a power of two
+			uint32_t ring_size{ 1024 * 1024 };
+		};
+
+		struct shm_message_header : message_header
+		{
+			uint32_t payload_size;
+		};
+
+		constexpr const uint32_t shared_magic = 0x43525043;	// 'CRPC'
+		constexpr const unsigned max_spin_count = 4096;
+		// while someone waits, the peer process is checked for liveness this often
+		constexpr const timespec liveness_check_interval{ 0, 100'000'000 };
+
+		static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+		// Positions are free-running, the producer owns tail and the consumer owns head
+		struct ring_control
+		{
+			alignas(64) std::atomic<uint64_t> tail;
+			alignas(64) std::atomic<uint64_t> head;
+		};
+
+		struct alignas(64) endpoint_control
+		{
+			// bumped by anyone who changes a condition the endpoint may be waiting for while it sleeps
+			std::atomic<uint32_t> doorbell;
+			std::atomic<uint32_t> sleeping;
+			std::atomic<uint32_t> closed;
+		};
+
+		// Lives at the start of the shared memory, followed by the data of the two rings.
+		// Endpoint 0 (server) produces into ring 0 and consumes ring 1, endpoint 1 (client) the other way around.
+		struct shared_control
+		{
+			uint32_t magic;
+			uint32_t ring_size;
+			ring_control rings[2];
+			endpoint_control endpoints[2];
+		};
+
+		constexpr const size_t data_offset = (sizeof(shared_control) + 4095) & ~size_t{ 4095 };
+
+		// spinning only helps if the peer can run at the same time
+		inline unsigned spin_count() noexcept
+		{
+			static const unsigned count = std::thread::hardware_concurrency() > 1 ? max_spin_count : 0;
+			return count;
+		}
+
+		inline void cpu_relax() noexcept
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+
+		// Process-shared futex, the words live in the shared mapping
+		inline void futex_wait(std::atomic<uint32_t> &word, uint32_t expected, const timespec *timeout) noexcept
+		{
+			::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+		}
+
+		inline void futex_wake(std::atomic<uint32_t> &word) noexcept
+		{
+			::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+		}
+
+		class byte_ring
+		{
+			ring_control *control{};
+			std::byte *data{};
+			uint64_t capacity{};
+
+		public:
+			byte_ring() = default;
+			byte_ring(ring_control *control, std::byte *data, uint64_t capacity) noexcept :
+				control{ control },
+				data{ data },
+				capacity{ capacity }
+			{}
+
+			bool readable() const noexcept
+			{
+				return control->tail.load(std::memory_order_acquire) != control->head.load(std::memory_order_relaxed);
+			}
+
+			bool writable() const noexcept
+			{
+				return control->tail.load(std::memory_order_relaxed) - control->head.load(std::memory_order_acquire) < capacity;
+			}
+
+			size_t write_some(std::span<const std::byte> in) noexcept
+			{
+				const auto tail = control->tail.load(std::memory_order_relaxed);
+				const auto size = std::min<uint64_t>(in.size(), capacity - (tail - control->head.load(std::memory_order_acquire)));
+				const auto offset = tail & (capacity - 1);
+				const auto first = std::min(size, capacity - offset);
+				std::memcpy(data + offset, in.data(), first);
+				std::memcpy(data, in.data() + first, size - first);
+				control->tail.store(tail + size, std::memory_order_release);
+				return size;
+			}
+
+			size_t read_some(std::span<std::byte> out) noexcept
+			{
+				const auto head = control->head.load(std::memory_order_relaxed);
+				const auto size = std::min<uint64_t>(out.size(), control->tail.load(std::memory_order_acquire) - head);
+				const auto offset = head & (capacity - 1);
+				const auto first = std::min(size, capacity - offset);
+				std::memcpy(out.data(), data + offset, first);
+				std::memcpy(out.data() + first, data, size - first);
+				control->head.store(head + size, std::memory_order_release);
+				return size;
+			}
+		};
+
+		// One side of a shared memory channel.
+		// A dedicated waiter thread resumes the reader and the writer when their ring becomes ready: it spins for a while, then sleeps
+		// on the endpoint's doorbell futex. Once resumed, the reader keeps running on the waiter thread, so a busy connection never sleeps.
+		// The hand-over socket stays open to detect the death of the peer process.
+		// Every connection therefore costs a thread on each side, and up to max_spin_count iterations of a busy CPU each time
+		// the reader or the writer starts waiting. The thread is joined by `close`.
+		class channel
+		{
+			std::thread waiter;
+			posix::impl::mapping memory;
+			posix::async_socket peer_socket;
+			shared_control *shared;
+			endpoint_control &self, &peer;
+			byte_ring incoming, outgoing;
+
+			std::atomic<void *> reader{}, writer{};
+			std::atomic<bool> cancelled{}, stopping{};
+			std::atomic<bool> peer_gone{};
+
+			void ring_doorbell(endpoint_control &endpoint) noexcept
+			{
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (endpoint.sleeping.load(std::memory_order_relaxed))
+				{
+					endpoint.doorbell.fetch_add(1, std::memory_order_release);
+					futex_wake(endpoint.doorbell);
+				}
+			}
+
+			bool peer_closed() const noexcept
+			{
+				return peer_gone.load(std::memory_order_relaxed) || peer.closed.load(std::memory_order_acquire);
+			}
+
+			void check_peer() noexcept
+			{
+				pollfd fd{ peer_socket.get(), POLLRDHUP, 0 };
+				if (::poll(&fd, 1, 0) > 0 && (fd.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+					peer_gone.store(true, std::memory_order_relaxed);
+			}
+
+			// Resumes waiters whose condition is met, returns false if nothing happened
+			bool dispatch() noexcept
+			{
+				const auto aborted = cancelled.load(std::memory_order_relaxed) || stopping.load(std::memory_order_relaxed) || peer_closed();
+				bool progress{};
+				if (reader.load(std::memory_order_seq_cst) && (aborted || incoming.readable()))
+				{
+					if (auto *h = reader.exchange(nullptr))
+					{
+						progress = true;
+						std::coroutine_handle<>::from_address(h).resume();
+					}
+				}
+				if (writer.load(std::memory_order_seq_cst) && (aborted || outgoing.writable()))
+				{
+					if (auto *h = writer.exchange(nullptr))
+					{
+						progress = true;
+						std::coroutine_handle<>::from_address(h).resume();
+					}
+				}
+				return progress;
+			}
+
+			bool has_waiters() const noexcept
+			{
+				return reader.load(std::memory_order_seq_cst) || writer.load(std::memory_order_seq_cst);
+			}
+
+			void run() noexcept
+			{
+				const auto spin_limit = spin_count();
+				unsigned spins{};
+				while (!stopping.load(std::memory_order_relaxed) || has_waiters())
+				{
+					const auto bell = self.doorbell.load(std::memory_order_acquire);
+					if (dispatch())
+					{
+						spins = 0;
+						continue;
+					}
+					if (has_waiters() && spins < spin_limit)
+					{
+						++spins;
+						cpu_relax();
+						continue;
+					}
+
+					self.sleeping.store(1, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (!dispatch() && !stopping.load(std::memory_order_relaxed))
+					{
+						const auto waiting = has_waiters();
+						futex_wait(self.doorbell, bell, waiting ? &liveness_check_interval : nullptr);
+						if (waiting && self.doorbell.load(std::memory_order_relaxed) == bell)
+							check_peer();
+					}
+					self.sleeping.store(0, std::memory_order_relaxed);
+					spins = 0;
+				}
+			}
+
+			void wait(std::atomic<void *> &slot, std::coroutine_handle<> h) noexcept
+			{
+				slot.store(h.address(), std::memory_order_seq_cst);
+				ring_doorbell(self);
+			}
+
+			void wake_self() noexcept
+			{
+				self.doorbell.fetch_add(1, std::memory_order_release);
+				futex_wake(self.doorbell);
+			}
+
+			void throw_if_aborted(bool has_data) const
+			{
+				if (cancelled.load(std::memory_order_relaxed) || stopping.load(std::memory_order_relaxed))
+					throw corsl::operation_cancelled{};
+				if (!has_data && peer_closed())
+					posix::throw_errno(ECONNRESET);
+			}
+
+		public:
+			channel(posix::impl::mapping &&memory, posix::async_socket &&peer_socket, unsigned side) noexcept :
+				memory{ std::move(memory) },
+				peer_socket{ std::move(peer_socket) },
+				shared{ this->memory.at<shared_control>() },
+				self{ shared->endpoints[side] },
+				peer{ shared->endpoints[side ^ 1] },
+				incoming{ &shared->rings[side ^ 1], this->memory.at(data_offset + (side ^ 1) * size_t{ shared->ring_size }), shared->ring_size },
+				outgoing{ &shared->rings[side], this->memory.at(data_offset + side * size_t{ shared->ring_size }), shared->ring_size }
+			{}
+
+			// The waiter thread keeps the channel alive until it exits
+			static void start(const std::shared_ptr<channel> &c)
+			{
+				c->waiter = std::thread{ [c]
+					{
+						c->run();
+					} };
+			}
+
+			// Tells the peer no more data is coming, stops the waiter thread and joins it. When called on the waiter thread itself,
+			// for instance by a reader that resumed there, the thread is detached and exits once the current dispatch returns.
+			void close() noexcept
+			{
+				self.closed.store(1, std::memory_order_release);
+				peer.doorbell.fetch_add(1, std::memory_order_release);
+				futex_wake(peer.doorbell);
+				stopping.store(true, std::memory_order_relaxed);
+				wake_self();
+
+				if (!waiter.joinable())
+					return;
+				if (waiter.get_id() == std::this_thread::get_id())
+					waiter.detach();
+				else
+					waiter.join();
+			}
+
+			void cancel() noexcept
+			{
+				cancelled.store(true, std::memory_order_relaxed);
+				wake_self();
+			}
+
+			// Returns 0 if no data is available
+			size_t receive_some(std::span<std::byte> out)
+			{
+				if (const auto size = incoming.read_some(out))
+				{
+					ring_doorbell(peer);
+					return size;
+				}
+				throw_if_aborted(false);
+				return 0;
+			}
+
+			// Returns 0 if the ring is full
+			size_t send_some(std::span<const std::byte> in)
+			{
+				throw_if_aborted(true);
+				if (peer_closed())
+					posix::throw_errno(ECONNRESET);
+				return outgoing.write_some(in);
+			}
+
+			void flush() noexcept
+			{
+				ring_doorbell(peer);
+			}
+
+			auto data_available() noexcept
+			{
+				struct awaiter
+				{
+					channel &c;
+
+					bool await_ready() const noexcept
+					{
+						return c.incoming.readable();
+					}
+
+					void await_suspend(std::coroutine_handle<> h) noexcept
+					{
+						c.wait(c.reader, h);
+					}
+
+					void await_resume() const noexcept
+					{}
+				};
+
+				return awaiter{ *this };
+			}
+
+			auto space_available() noexcept
+			{
+				struct awaiter
+				{
+					channel &c;
+
+					bool await_ready() const noexcept
+					{
+						return c.outgoing.writable();
+					}
+
+					void await_suspend(std::coroutine_handle<> h) noexcept
+					{
+						c.wait(c.writer, h);
+					}
+
+					void await_resume() const noexcept
+					{}
+				};
+
+				return awaiter{ *this };
+			}
+		};
+
+		struct channel_canceller
+		{
+			channel *c;
+
+			void operator()() const noexcept
+			{
+				c->cancel();
+			}
+		};
+
+		// Creates the shared memory for a new connection and passes it to the client
+		inline std::shared_ptr<channel> create_channel(posix::file_descriptor &&socket, uint32_t ring_size)
+		{
+			ring_size = std::bit_ceil(std::max(ring_size, uint32_t{ 4096 }));
+			const auto size = data_offset + 2 * size_t{ ring_size };
+			posix::file_descriptor file{ posix::check_posix_api(::memfd_create("crpc-shm", MFD_CLOEXEC)) };
+			posix::check_posix_api(::ftruncate(file.get(), static_cast<off_t>(size)));
+			posix::impl::mapping memory{ ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.get(), 0), size };
+			if (memory.at() == MAP_FAILED)
+				posix::throw_last_error();
+
+			auto *shared = new (memory.at()) shared_control{};
+			shared->magic = shared_magic;
+			shared->ring_size = ring_size;
+
+			const std::byte tag{};
+			iovec vector{ const_cast<std::byte *>(&tag), 1 };
+			posix::descriptor_control<1> control{};
+			msghdr msg{};
+			msg.msg_iov = &vector;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control.data;
+			msg.msg_controllen = sizeof(control.data);
+			auto *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			const auto fd = file.get();
+			std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+			// a fresh socket always has room for a single byte
+			posix::check_posix_api(::sendmsg(socket.get(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT));
+
+			auto result = std::make_shared<channel>(std::move(memory), posix::async_socket{ std::move(socket) }, 0);
+			channel::start(result);
+			return result;
+		}
+
+		// Receives the shared memory from the server
+		inline corsl::future<std::shared_ptr<channel>> open_channel(posix::file_descriptor &&socket, const corsl::cancellation_source &cancel)
+		{
+			posix::async_socket peer_socket{ std::move(socket) };
+			posix::file_descriptor file;
+			for (;;)
+			{
+				std::byte tag;
+				iovec vector{ &tag, 1 };
+				posix::descriptor_control<1> control;
+				msghdr msg{};
+				msg.msg_iov = &vector;
+				msg.msg_iovlen = 1;
+				msg.msg_control = control.data;
+				msg.msg_controllen = sizeof(control.data);
+
+				if (const auto r = ::recvmsg(peer_socket.get(), &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC); r > 0)
+				{
+					if (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+					{
+						int fd;
+						std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+						file.reset(fd);
+					}
+					break;
+				}
+				else if (r == 0)
+					posix::throw_errno(ECONNRESET);
+				else if (errno == EAGAIN || errno == EWOULDBLOCK)
+					co_await peer_socket.readable(cancel);
+				else if (errno != EINTR)
+					posix::throw_last_error();
+			}
+
+			struct stat info{};
+			if (!file || ::fstat(file.get(), &info) != 0 || static_cast<size_t>(info.st_size) < data_offset)
+				posix::throw_error(E_INVALIDARG);
+			const auto size = static_cast<size_t>(info.st_size);
+			posix::impl::mapping memory{ ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.get(), 0), size };
+			if (memory.at() == MAP_FAILED)
+				posix::throw_last_error();
+
+			const auto *shared = memory.at<shared_control>();
+			if (shared->magic != shared_magic || !std::has_single_bit(shared->ring_size) || data_offset + 2 * size_t{ shared->ring_size } > size)
+				posix::throw_error(E_INVALIDARG);
+
+			auto result = std::make_shared<channel>(std::move(memory), std::move(peer_socket), 1);
+			channel::start(result);
+			co_return std::move(result);
+		}
+
+		// Same-host transport over two single-producer/single-consumer byte rings in shared memory, one per direction.
+		// The shared memory is handed over through an AF_UNIX socket when the connection is established.
+		class shm_transport
+		{
+			std::shared_ptr<channel> ch;
+			std::unique_ptr<corsl::cancellation_subscription<channel_canceller>> subscription;
+			corsl::cancellation_source cancel;
+
+			void close() noexcept
+			{
+				subscription.reset();
+				if (ch)
+				{
+					ch->close();
+					ch.reset();
+				}
+			}
+
+			corsl::future<> send(std::span<const std::byte> first, std::span<const std::byte> second)
+			{
+				for (auto data : { first, second })
+				{
+					while (!data.empty())
+					{
+						if (const auto size = ch->send_some(data))
+							data = data.subspan(size);
+						else
+						{
+							ch->flush();
+							co_await ch->space_available();
+						}
+					}
+				}
+				ch->flush();
+			}
+
+		public:
+			shm_transport() = default;
+			explicit shm_transport(std::shared_ptr<channel> ch) noexcept :
+				ch{ std::move(ch) }
+			{}
+
+			shm_transport(shm_transport &&) = default;
+
+			shm_transport &operator =(shm_transport &&o) noexcept
+			{
+				if (this != &o)
+				{
+					close();
+					ch = std::move(o.ch);
+					subscription = std::move(o.subscription);
+					cancel = std::move(o.cancel);
+				}
+				return *this;
+			}
+
+			~shm_transport()
+			{
+				close();
+			}
+
+			void set_cancellation_token(const corsl::cancellation_source &src)
+			{
+				cancel = src.create_connected_source();
+				subscription = std::make_unique<corsl::cancellation_subscription<channel_canceller>>(cancel.get_token(), channel_canceller{ ch.get() });
+			}
+
+			corsl::future<message_t> read()
+			{
+				shm_message_header header;
+				const auto header_bytes = std::as_writable_bytes(std::span{ &header, 1 });
+				for (size_t received = 0; received < header_bytes.size();)
+				{
+					if (const auto size = ch->receive_some(header_bytes.subspan(received)))
+						received += size;
+					else
+						co_await ch->data_available();
+				}
+
+				payload_t payload(header.payload_size);
+				for (size_t received = 0; received < payload.size();)
+				{
+					if (const auto size = ch->receive_some(std::span{ payload }.subspan(received)))
+						received += size;
+					else
+						co_await ch->data_available();
+				}
+
+				co_return message_t{ header, std::move(payload) };
+			}
+
+			corsl::future<> write(message_t message)
+			{
+				const shm_message_header header{ message, static_cast<uint32_t>(message.payload.size()) };
+				co_await send(std::as_bytes(std::span{ &header, 1 }), message.payload);
+			}
+
+			corsl::future<> connect(const shm_config &config)
+			{
+				auto channel = co_await open_channel(unix_socket::connect_socket(config.path), cancel);
+				ch = std::move(channel);
+			}
+		};
+
+		class shm_listener
+		{
+			unix_socket::unix_listener listener;
+			uint32_t ring_size{};
+
+		public:
+			corsl::future<> create_server(const shm_config &config)
+			{
+				ring_size = config.ring_size;
+				return listener.create_server({ config.path });
+			}
+
+			corsl::future<shm_transport> wait_client(const corsl::cancellation_source &cancel)
+			{
+				auto fd = co_await listener.accept(cancel);
+				shm_transport transport{ create_channel(std::move(fd), ring_size) };
+				co_return std::move(transport);
+			}
+		};
+
+		static_assert(concepts::transport<shm_transport>);
+	}
+
+	namespace transports::shm
+	{
+		using config_t = details::shm::shm_config;
+		using details::shm::shm_transport;
+		using details::shm::shm_listener;
+	}
+}
@@ -0,0 +1,358 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "runtime.h"
+
+#include <climits>
+#include <span>
+#include <string>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace crpc::posix
+{
+	// Control data buffer for up to `Count` descriptors passed with SCM_RIGHTS. The alignment is part of the type:
+	// g++ does not honour alignas on a local variable that lives in a coroutine frame.
+	template<size_t Count>
+	struct alignas(cmsghdr) descriptor_control
+	{
+		std::byte data[CMSG_SPACE(sizeof(int) * Count)];
+	};
+
+	class file_descriptor
+	{
+		int fd{ -1 };
+
+	public:
+		file_descriptor() = default;
+		explicit file_descriptor(int fd) noexcept :
+			fd{ fd }
+		{}
+
+		file_descriptor(file_descriptor &&o) noexcept :
+			fd{ std::exchange(o.fd, -1) }
+		{}
+
+		file_descriptor &operator =(file_descriptor &&o) noexcept
+		{
+			if (this != &o)
+				reset(std::exchange(o.fd, -1));
+			return *this;
+		}
+
+		~file_descriptor()
+		{
+			reset();
+		}
+
+		int get() const noexcept
+		{
+			return fd;
+		}
+
+		int release() noexcept
+		{
+			return std::exchange(fd, -1);
+		}
+
+		void reset(int new_fd = -1) noexcept
+		{
+			if (fd >= 0)
+				::close(fd);
+			fd = new_fd;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return fd >= 0;
+		}
+	};
+
+	namespace impl
+	{
+		// Readiness of one direction of a socket: idle, notified or the address of a waiting coroutine
+		class readiness_slot
+		{
+			static constexpr const std::uintptr_t idle = 0;
+			static constexpr const std::uintptr_t notified = 1;
+
+			std::atomic<std::uintptr_t> slot{ idle };
+
+		public:
+			// Called by the reactor. Posts the waiter to `home`, or to the background pool if `home` is null,
+			// or remembers the notification for the next wait. The waiter never runs on the reactor's dispatch stack.
+			void signal(event_loop *home) noexcept
+			{
+				auto current = slot.load(std::memory_order_acquire);
+				for (;;)
+				{
+					if (current == idle || current == notified)
+					{
+						if (slot.compare_exchange_weak(current, notified, std::memory_order_acq_rel, std::memory_order_acquire))
+							return;
+					}
+					else if (slot.compare_exchange_weak(current, idle, std::memory_order_acq_rel, std::memory_order_acquire))
+					{
+						const auto h = std::coroutine_handle<>::from_address(reinterpret_cast<void *>(current));
+						if (home)
+							home->post(h);
+						else
+							background_pool().post(h);
+						return;
+					}
+				}
+			}
+
+			// Wakes the waiter, if any, on `home`, or on the background pool if `home` is null
+			void kick(event_loop *home) noexcept
+			{
+				auto current = slot.load(std::memory_order_acquire);
+				while (current != idle && current != notified)
+				{
+					if (slot.compare_exchange_weak(current, idle, std::memory_order_acq_rel, std::memory_order_acquire))
+					{
+						const auto h = std::coroutine_handle<>::from_address(reinterpret_cast<void *>(current));
+						if (home)
+							home->post(h);
+						else
+							background_pool().post(h);
+						return;
+					}
+				}
+			}
+
+			bool consume_notification() noexcept
+			{
+				auto expected = notified;
+				return slot.compare_exchange_strong(expected, idle, std::memory_order_acq_rel, std::memory_order_acquire);
+			}
+
+			// returns false if a notification arrived in the meantime, consuming it
+			bool install(std::coroutine_handle<> h) noexcept
+			{
+				auto expected = idle;
+				if (slot.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(h.address()), std::memory_order_acq_rel, std::memory_order_acquire))
+					return true;
+				slot.store(idle, std::memory_order_release);
+				return false;
+			}
+
+			bool uninstall(std::coroutine_handle<> h) noexcept
+			{
+				auto expected = reinterpret_cast<std::uintptr_t>(h.address());
+				return slot.compare_exchange_strong(expected, idle, std::memory_order_acq_rel, std::memory_order_acquire);
+			}
+		};
+
+		struct socket_state final : io_handler
+		{
+			file_descriptor fd;
+			event_loop *loop;
+			// the loop a pinned socket resumes its waiters on, null if they are resumed on the background pool
+			event_loop *home;
+			readiness_slot read_slot, write_slot;
+
+			socket_state(file_descriptor &&fd, event_loop &loop, event_loop *home) noexcept :
+				fd{ std::move(fd) },
+				loop{ &loop },
+				home{ home }
+			{}
+
+			void on_io(uint32_t events) noexcept override
+			{
+				if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+					read_slot.signal(home);
+				if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+					write_slot.signal(home);
+			}
+
+			void kick() noexcept
+			{
+				read_slot.kick(home);
+				write_slot.kick(home);
+			}
+		};
+
+		struct socket_kicker
+		{
+			socket_state *state;
+
+			void operator()() const noexcept
+			{
+				state->kick();
+			}
+		};
+
+		// Suspends until the reactor reports readiness. Throws operation_cancelled if the source is cancelled.
+		class readiness_awaiter
+		{
+			readiness_slot &slot;
+			const cancellation_state *cancel;
+
+			bool is_cancelled() const noexcept
+			{
+				return cancel && cancel->is_cancelled();
+			}
+
+		public:
+			readiness_awaiter(readiness_slot &slot, const cancellation_state *cancel) noexcept :
+				slot{ slot },
+				cancel{ cancel }
+			{}
+
+			bool await_ready() noexcept
+			{
+				return is_cancelled() || slot.consume_notification();
+			}
+
+			bool await_suspend(std::coroutine_handle<> h) noexcept
+			{
+				// once installed, the coroutine may be resumed on another thread and this awaiter destroyed
+				auto &s = slot;
+				const auto *c = cancel;
+				if (!s.install(h))
+					return false;
+				// cancellation callbacks run after the flag is set, so a kick could have been missed only if this check sees it
+				if (c && c->is_cancelled() && s.uninstall(h))
+					return false;
+				return true;
+			}
+
+			void await_resume() const
+			{
+				if (is_cancelled())
+					throw operation_cancelled{};
+			}
+		};
+	}
+
+	// A non-blocking descriptor registered (edge-triggered) with an event loop
+	class async_socket
+	{
+		std::shared_ptr<impl::socket_state> state;
+		std::unique_ptr<cancellation_subscription<impl::socket_kicker>> subscription;
+
+		async_socket(file_descriptor &&fd, event_loop &loop, event_loop *home) :
+			state{ std::make_shared<impl::socket_state>(std::move(fd), loop, home) }
+		{
+			loop.add(state->fd.get(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, state.get());
+		}
+
+	public:
+		async_socket() = default;
+
+		// Registers with one of the reactors, waits are resumed on the background pool
+		explicit async_socket(file_descriptor &&fd) :
+			async_socket{ std::move(fd), reactors().pick(), nullptr }
+		{}
+
+		// Pinned to `loop`: registers with it and waits are resumed on its thread
+		async_socket(file_descriptor &&fd, event_loop &loop) :
+			async_socket{ std::move(fd), loop, &loop }
+		{}
+
+		async_socket(async_socket &&) = default;
+
+		async_socket &operator =(async_socket &&o) noexcept
+		{
+			if (this != &o)
+			{
+				close();
+				state = std::move(o.state);
+				subscription = std::move(o.subscription);
+			}
+			return *this;
+		}
+
+		~async_socket()
+		{
+			close();
+		}
+
+		void close() noexcept
+		{
+			subscription.reset();
+			if (state)
+			{
+				auto *loop = state->loop;
+				const auto fd = state->fd.get();
+				loop->remove(fd, std::move(state));
+			}
+		}
+
+		int get() const noexcept
+		{
+			return state ? state->fd.get() : -1;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return static_cast<bool>(state);
+		}
+
+		event_loop &get_loop() const noexcept
+		{
+			return *state->loop;
+		}
+
+		// Pending and future waits wake up and throw operation_cancelled when the source is cancelled
+		void set_cancellation_token(const cancellation_source &cancel)
+		{
+			subscription = std::make_unique<cancellation_subscription<impl::socket_kicker>>(cancel.get_token(), impl::socket_kicker{ state.get() });
+		}
+
+		void kick() noexcept
+		{
+			state->kick();
+		}
+
+		impl::readiness_awaiter readable(const cancellation_source &cancel) const noexcept
+		{
+			return { state->read_slot, cancel.get_token().get_state().get() };
+		}
+
+		impl::readiness_awaiter writable(const cancellation_source &cancel) const noexcept
+		{
+			return { state->write_slot, cancel.get_token().get_state().get() };
+		}
+	};
+
+	namespace impl
+	{
+		struct addrinfo_deleter
+		{
+			void operator()(addrinfo *p) const noexcept
+			{
+				::freeaddrinfo(p);
+			}
+		};
+
+		using addrinfo_ptr = std::unique_ptr<addrinfo, addrinfo_deleter>;
+
+		inline addrinfo_ptr resolve(const std::string &address, uint16_t port, bool passive)
+		{
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+			addrinfo *result{};
+			const auto service = std::to_string(port);
+			if (const auto err = ::getaddrinfo(address.empty() ? nullptr : address.c_str(), service.c_str(), &hints, &result); err != 0)
+				throw_errno(err == EAI_SYSTEM ? errno : EHOSTUNREACH);
+			return addrinfo_ptr{ result };
+		}
+	}
+}
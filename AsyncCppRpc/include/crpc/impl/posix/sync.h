@@ -0,0 +1,58 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <mutex>
+#include <shared_mutex>
+
+namespace crpc::posix
+{
+	// Slim reader-writer lock, usable with std::scoped_lock and std::shared_lock
+	class srwlock
+	{
+		std::shared_mutex m;
+
+	public:
+		srwlock() = default;
+		srwlock(const srwlock &) = delete;
+		srwlock &operator =(const srwlock &) = delete;
+
+		void lock() noexcept
+		{
+			m.lock();
+		}
+
+		bool try_lock() noexcept
+		{
+			return m.try_lock();
+		}
+
+		void unlock() noexcept
+		{
+			m.unlock();
+		}
+
+		void lock_shared() noexcept
+		{
+			m.lock_shared();
+		}
+
+		bool try_lock_shared() noexcept
+		{
+			return m.try_lock_shared();
+		}
+
+		void unlock_shared() noexcept
+		{
+			m.unlock_shared();
+		}
+	};
+
+	using mutex = std::mutex;
+}
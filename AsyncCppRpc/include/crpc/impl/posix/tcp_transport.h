@@ -0,0 +1,392 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "../transport.h"
+#include "socket.h"
+
+namespace crpc
+{
+	namespace details::tcp
+	{
+		struct tcp_config
+		{
+			std::string address;
+			uint16_t port;
+		};
+
+		struct tcp_message_header : message_header
+		{
+			uint32_t payload_size;
+		};
+
+		constexpr const size_t receive_buffer_size = 65536;
+		// After a payload of at least this size the next frame is assumed to be large too and is received without the buffer
+		constexpr const size_t direct_receive_threshold = 16 * 1024;
+
+		inline void set_socket_options(int fd) noexcept
+		{
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+		}
+
+		// TCP transport over a non-blocking socket driven by an edge-triggered epoll reactor.
+		// Small messages are parsed out of a single receive buffer, the rest of a large payload is received straight into the payload.
+		// Once a large payload has been seen, the following frames are received header first and then straight into the payload
+		// (no copy), until a small one shows up again: for small frames one buffered recv plus a copy is cheaper than two recvs.
+		class tcp_transport
+		{
+			corsl::cancellation_source cancel;
+			posix::async_socket socket;
+			posix::event_loop *home{};
+			std::vector<std::byte> receive_buffer;
+			size_t receive_begin{}, receive_end{};
+			bool expect_large{};
+			std::vector<tcp_message_header> batch_headers;
+			std::vector<iovec> batch_buffers;
+
+			size_t buffered() const noexcept
+			{
+				return receive_end - receive_begin;
+			}
+
+			corsl::future<size_t> receive_some(std::span<std::byte> buffer)
+			{
+				for (;;)
+				{
+					if (const auto r = ::recv(socket.get(), buffer.data(), buffer.size(), MSG_DONTWAIT); r > 0)
+						co_return static_cast<size_t>(r);
+					else if (r == 0)
+						posix::throw_errno(ECONNRESET);
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await socket.readable(cancel);
+					else if (errno != EINTR)
+						posix::throw_last_error();
+				}
+			}
+
+			corsl::future<> receive_exactly(std::span<std::byte> buffer)
+			{
+				for (size_t received = 0; received < buffer.size();)
+					received += co_await receive_some(buffer.subspan(received));
+			}
+
+			corsl::future<> read_next()
+			{
+				if (receive_buffer.empty())
+					receive_buffer.resize(receive_buffer_size);
+				if (receive_begin == receive_end)
+					receive_begin = receive_end = 0;
+				else if (receive_buffer.size() - receive_end < sizeof(tcp_message_header))
+				{
+					std::memmove(receive_buffer.data(), receive_buffer.data() + receive_begin, buffered());
+					receive_end -= receive_begin;
+					receive_begin = 0;
+				}
+				receive_end += co_await receive_some(std::span{ receive_buffer }.subspan(receive_end));
+			}
+
+			// Moves a message that has been received in full out of the receive buffer
+			bool take_buffered(std::vector<message_t> &messages)
+			{
+				if (buffered() < sizeof(tcp_message_header))
+					return false;
+
+				tcp_message_header header;
+				std::memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				if (buffered() - sizeof(header) < header.payload_size)
+					return false;
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				std::memcpy(payload.data(), receive_buffer.data() + receive_begin, payload.size());
+				receive_begin += payload.size();
+				expect_large = payload.size() >= direct_receive_threshold;
+				messages.emplace_back(header, std::move(payload));
+				return true;
+			}
+
+			corsl::future<> send_all(std::span<iovec> buffers)
+			{
+				auto *iov = buffers.data();
+				auto count = buffers.size();
+
+				while (count)
+				{
+					msghdr msg{};
+					msg.msg_iov = iov;
+					msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+					if (const auto r = ::sendmsg(socket.get(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT); r >= 0)
+					{
+						auto sent = static_cast<size_t>(r);
+						while (count && sent >= iov->iov_len)
+						{
+							sent -= iov->iov_len;
+							++iov;
+							--count;
+						}
+						if (count)
+						{
+							iov->iov_base = static_cast<std::byte *>(iov->iov_base) + sent;
+							iov->iov_len -= sent;
+						}
+					}
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await socket.writable(cancel);
+					else if (errno != EINTR)
+						posix::throw_last_error();
+				}
+			}
+
+		public:
+			tcp_transport() = default;
+			explicit tcp_transport(posix::file_descriptor &&fd) :
+				socket{ (set_socket_options(fd.get()), std::move(fd)) }
+			{}
+
+			// A transport pinned to `loop`: the socket is registered with it and the connection runs on its thread
+			tcp_transport(posix::file_descriptor &&fd, posix::event_loop &loop) :
+				socket{ (set_socket_options(fd.get()), std::move(fd)), loop },
+				home{ &loop }
+			{}
+
+			executor_ref get_executor() const noexcept
+			{
+				return home ? executor_ref{ *home } : executor_ref{};
+			}
+
+			void set_cancellation_token(const corsl::cancellation_source &src)
+			{
+				cancel = src.create_connected_source();
+				socket.set_cancellation_token(cancel);
+			}
+
+			corsl::future<message_t> read()
+			{
+				tcp_message_header header;
+				if (expect_large && !buffered())
+				{
+					co_await receive_exactly(std::as_writable_bytes(std::span{ &header, 1 }));
+					payload_t payload(header.payload_size);
+					co_await receive_exactly(payload);
+					expect_large = payload.size() >= direct_receive_threshold;
+					co_return message_t{ header, std::move(payload) };
+				}
+
+				while (buffered() < sizeof(tcp_message_header))
+					co_await read_next();
+
+				std::memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				const auto from_buffer = std::min(buffered(), payload.size());
+				std::memcpy(payload.data(), receive_buffer.data() + receive_begin, from_buffer);
+				receive_begin += from_buffer;
+
+				co_await receive_exactly(std::span{ payload }.subspan(from_buffer));
+				expect_large = payload.size() >= direct_receive_threshold;
+				co_return message_t{ header, std::move(payload) };
+			}
+
+			corsl::future<> read_batch(std::vector<message_t> &messages)
+			{
+				if (!take_buffered(messages))
+				{
+					auto message = co_await read();
+					messages.push_back(std::move(message));
+				}
+				while (take_buffered(messages))
+				{
+				}
+			}
+
+			corsl::future<> write(message_t message)
+			{
+				tcp_message_header header{ message, static_cast<uint32_t>(message.payload.size()) };
+				iovec buffers[]{
+					{ &header, sizeof(header) },
+					{ message.payload.data(), message.payload.size() },
+				};
+				co_await send_all(std::span{ buffers, message.payload.empty() ? 1u : 2u });
+			}
+
+			corsl::future<> write_batch(std::span<message_t> messages)
+			{
+				batch_headers.clear();
+				batch_buffers.clear();
+				for (const auto &message : messages)
+					batch_headers.push_back({ message, static_cast<uint32_t>(message.payload.size()) });
+				for (size_t i = 0; i < messages.size(); ++i)
+				{
+					batch_buffers.push_back({ &batch_headers[i], sizeof(tcp_message_header) });
+					if (!messages[i].payload.empty())
+						batch_buffers.push_back({ messages[i].payload.data(), messages[i].payload.size() });
+				}
+				co_await send_all(batch_buffers);
+			}
+
+			corsl::future<> connect(const tcp_config &config)
+			{
+				const auto addresses = posix::impl::resolve(config.address, config.port, false);
+				int last_error = ECONNREFUSED;
+				for (auto *ai = addresses.get(); ai; ai = ai->ai_next)
+				{
+					posix::file_descriptor fd{ ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol) };
+					if (!fd)
+					{
+						last_error = errno;
+						continue;
+					}
+					set_socket_options(fd.get());
+					posix::async_socket candidate{ std::move(fd) };
+					if (::connect(candidate.get(), ai->ai_addr, ai->ai_addrlen) != 0)
+					{
+						if (errno != EINPROGRESS)
+						{
+							last_error = errno;
+							continue;
+						}
+						co_await candidate.writable(cancel);
+						socklen_t len = sizeof(last_error);
+						::getsockopt(candidate.get(), SOL_SOCKET, SO_ERROR, &last_error, &len);
+						if (last_error != 0)
+							continue;
+					}
+					socket = std::move(candidate);
+					co_return;
+				}
+				posix::throw_errno(last_error);
+			}
+		};
+
+		class tcp_listener
+		{
+			posix::async_socket listener;
+			posix::event_loop *home{};
+			int port{};
+
+			void listen_on(const posix::impl::addrinfo_ptr &addresses, posix::event_loop *loop = nullptr)
+			{
+				int last_error = EADDRNOTAVAIL;
+				for (auto *ai = addresses.get(); ai; ai = ai->ai_next)
+				{
+					posix::file_descriptor fd{ ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol) };
+					if (!fd)
+					{
+						last_error = errno;
+						continue;
+					}
+					int one = 1;
+					::setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+					if (loop)
+						::setsockopt(fd.get(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+					if (::bind(fd.get(), ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(fd.get(), SOMAXCONN) != 0)
+					{
+						last_error = errno;
+						continue;
+					}
+
+					sockaddr_storage bound{};
+					socklen_t len = sizeof(bound);
+					::getsockname(fd.get(), reinterpret_cast<sockaddr *>(&bound), &len);
+					port = ntohs(bound.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6 *>(&bound)->sin6_port : reinterpret_cast<sockaddr_in *>(&bound)->sin_port);
+
+					listener = loop ? posix::async_socket{ std::move(fd), *loop } : posix::async_socket{ std::move(fd) };
+					home = loop;
+					return;
+				}
+				posix::throw_errno(last_error);
+			}
+
+		public:
+			corsl::future<> create_server(const tcp_config &config)
+			{
+				listen_on(posix::impl::resolve(config.address, config.port, true));
+				co_return;
+			}
+
+			corsl::future<int> create_server()
+			{
+				listen_on(posix::impl::resolve({}, 0, true));
+				co_return port;
+			}
+
+			// Listens on its own SO_REUSEPORT socket registered with `loop`. Accepted connections are pinned to `loop`.
+			corsl::future<> create_server(const tcp_config &config, posix::event_loop &loop)
+			{
+				listen_on(posix::impl::resolve(config.address, config.port, true), &loop);
+				co_return;
+			}
+
+			// Thread-per-core server: one listener per reactor thread of posix::per_core_reactors(), all on the same port. Each of those
+			// threads is bound to its own CPU, accepts its own clients and runs their connections. If `config.port` is 0, the port chosen
+			// for the first listener is used.
+			static std::vector<tcp_listener> create_per_core_servers(tcp_config config)
+			{
+				auto &pool = posix::per_core_reactors();
+
+				std::vector<tcp_listener> result(pool.size());
+				for (size_t i = 0; i < pool.size(); ++i)
+				{
+					result[i].listen_on(posix::impl::resolve(config.address, config.port, true), &pool[i]);
+					if (!config.port)
+						config.port = static_cast<uint16_t>(result[i].port);
+				}
+				return result;
+			}
+
+			// Accepted connections are spread over the reactor threads, unless the listener is pinned
+			corsl::future<tcp_transport> wait_client(const corsl::cancellation_source &cancel)
+			{
+				auto fd = co_await accept(cancel);
+				if (home)
+					co_return tcp_transport{ std::move(fd), *home };
+				else
+					co_return tcp_transport{ std::move(fd) };
+			}
+
+			corsl::future<posix::file_descriptor> accept(const corsl::cancellation_source &cancel)
+			{
+				corsl::cancellation_token token{ co_await cancel };
+				corsl::cancellation_subscription subscription{ token, [this]
+					{
+						listener.kick();
+					} };
+
+				for (;;)
+				{
+					if (const auto fd = ::accept4(listener.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); fd >= 0)
+						co_return posix::file_descriptor{ fd };
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await listener.readable(cancel);
+					else if (errno != EINTR && errno != ECONNABORTED)
+						posix::throw_last_error();
+				}
+			}
+
+			int get_port() const noexcept
+			{
+				return port;
+			}
+		};
+
+		static_assert(concepts::batch_transport<tcp_transport>);
+		static_assert(concepts::batch_read_transport<tcp_transport>);
+		static_assert(concepts::pinned_transport<tcp_transport>);
+	}
+
+	namespace transports::tcp
+	{
+		using config_t = details::tcp::tcp_config;
+		using details::tcp::tcp_transport;
+		using details::tcp::tcp_listener;
+	}
+}
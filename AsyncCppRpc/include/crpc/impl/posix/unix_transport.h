@@ -0,0 +1,313 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "../transport.h"
+#include "socket.h"
+
+#include <sys/un.h>
+
+namespace crpc
+{
+	namespace details::unix_socket
+	{
+		struct unix_config
+		{
+			// Socket file path. A leading '@' denotes a name in the abstract namespace.
+			std::string path;
+		};
+
+		struct unix_message_header : message_header
+		{
+			uint32_t payload_size;
+		};
+
+		constexpr const size_t receive_buffer_size = 65536;
+		// After a payload of at least this size the next frame is assumed to be large too and is received without the buffer
+		constexpr const size_t direct_receive_threshold = 16 * 1024;
+
+		inline socklen_t make_address(const std::string &path, sockaddr_un &address)
+		{
+			address = {};
+			address.sun_family = AF_UNIX;
+			if (path.empty() || path.size() >= sizeof(address.sun_path))
+				posix::throw_errno(ENAMETOOLONG);
+			std::memcpy(address.sun_path, path.data(), path.size());
+			if (path[0] == '@')
+			{
+				address.sun_path[0] = '\0';
+				return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+			}
+			return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+		}
+
+		// Returns a connected non-blocking socket
+		inline posix::file_descriptor connect_socket(const std::string &path)
+		{
+			sockaddr_un address;
+			const auto length = make_address(path, address);
+			// a non-blocking connect fails instead of waiting when the backlog is full, connect in blocking mode instead
+			posix::file_descriptor fd{ posix::check_posix_api(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) };
+			while (::connect(fd.get(), reinterpret_cast<const sockaddr *>(&address), length) != 0)
+			{
+				if (errno != EINTR)
+					posix::throw_last_error();
+			}
+			posix::check_posix_api(::fcntl(fd.get(), F_SETFL, ::fcntl(fd.get(), F_GETFL) | O_NONBLOCK));
+			return fd;
+		}
+
+		// Stream transport over a connected AF_UNIX socket, driven by the epoll reactors.
+		// Small messages are parsed out of a single receive buffer, the rest of a large payload is received straight into the payload.
+		// After a large payload the following frames are received header first and then straight into the payload, as in tcp_transport.
+		class unix_transport
+		{
+			corsl::cancellation_source cancel;
+			posix::async_socket socket;
+			std::vector<std::byte> receive_buffer;
+			size_t receive_begin{}, receive_end{};
+			bool expect_large{};
+			std::vector<unix_message_header> batch_headers;
+			std::vector<iovec> batch_buffers;
+
+			size_t buffered() const noexcept
+			{
+				return receive_end - receive_begin;
+			}
+
+			corsl::future<size_t> receive_some(std::span<std::byte> buffer)
+			{
+				for (;;)
+				{
+					if (const auto r = ::recv(socket.get(), buffer.data(), buffer.size(), MSG_DONTWAIT); r > 0)
+						co_return static_cast<size_t>(r);
+					else if (r == 0)
+						posix::throw_errno(ECONNRESET);
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await socket.readable(cancel);
+					else if (errno != EINTR)
+						posix::throw_last_error();
+				}
+			}
+
+			corsl::future<> receive_exactly(std::span<std::byte> buffer)
+			{
+				for (size_t received = 0; received < buffer.size();)
+					received += co_await receive_some(buffer.subspan(received));
+			}
+
+			corsl::future<> read_next()
+			{
+				if (receive_buffer.empty())
+					receive_buffer.resize(receive_buffer_size);
+				if (receive_begin == receive_end)
+					receive_begin = receive_end = 0;
+				else if (receive_buffer.size() - receive_end < sizeof(unix_message_header))
+				{
+					std::memmove(receive_buffer.data(), receive_buffer.data() + receive_begin, buffered());
+					receive_end -= receive_begin;
+					receive_begin = 0;
+				}
+				receive_end += co_await receive_some(std::span{ receive_buffer }.subspan(receive_end));
+			}
+
+			// Moves a message that has been received in full out of the receive buffer
+			bool take_buffered(std::vector<message_t> &messages)
+			{
+				if (buffered() < sizeof(unix_message_header))
+					return false;
+
+				unix_message_header header;
+				std::memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				if (buffered() - sizeof(header) < header.payload_size)
+					return false;
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				std::memcpy(payload.data(), receive_buffer.data() + receive_begin, payload.size());
+				receive_begin += payload.size();
+				expect_large = payload.size() >= direct_receive_threshold;
+				messages.emplace_back(header, std::move(payload));
+				return true;
+			}
+
+			corsl::future<> send_all(std::span<iovec> buffers)
+			{
+				msghdr msg{};
+				msg.msg_iov = buffers.data();
+				auto count = buffers.size();
+
+				while (count)
+				{
+					msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+					if (const auto r = ::sendmsg(socket.get(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT); r >= 0)
+					{
+						auto sent = static_cast<size_t>(r);
+						while (count && sent >= msg.msg_iov->iov_len)
+						{
+							sent -= msg.msg_iov->iov_len;
+							++msg.msg_iov;
+							--count;
+						}
+						if (count)
+						{
+							msg.msg_iov->iov_base = static_cast<std::byte *>(msg.msg_iov->iov_base) + sent;
+							msg.msg_iov->iov_len -= sent;
+						}
+					}
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await socket.writable(cancel);
+					else if (errno != EINTR)
+						posix::throw_last_error();
+				}
+			}
+
+		public:
+			unix_transport() = default;
+			explicit unix_transport(posix::file_descriptor &&fd) :
+				socket{ std::move(fd) }
+			{}
+
+			void set_cancellation_token(const corsl::cancellation_source &src)
+			{
+				cancel = src.create_connected_source();
+				socket.set_cancellation_token(cancel);
+			}
+
+			corsl::future<message_t> read()
+			{
+				unix_message_header header;
+				if (expect_large && !buffered())
+				{
+					co_await receive_exactly(std::as_writable_bytes(std::span{ &header, 1 }));
+					payload_t payload(header.payload_size);
+					co_await receive_exactly(payload);
+					expect_large = payload.size() >= direct_receive_threshold;
+					co_return message_t{ header, std::move(payload) };
+				}
+
+				while (buffered() < sizeof(unix_message_header))
+					co_await read_next();
+
+				std::memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				const auto from_buffer = std::min(buffered(), payload.size());
+				std::memcpy(payload.data(), receive_buffer.data() + receive_begin, from_buffer);
+				receive_begin += from_buffer;
+
+				co_await receive_exactly(std::span{ payload }.subspan(from_buffer));
+				expect_large = payload.size() >= direct_receive_threshold;
+				co_return message_t{ header, std::move(payload) };
+			}
+
+			corsl::future<> read_batch(std::vector<message_t> &messages)
+			{
+				if (!take_buffered(messages))
+				{
+					auto message = co_await read();
+					messages.push_back(std::move(message));
+				}
+				while (take_buffered(messages))
+				{
+				}
+			}
+
+			corsl::future<> write(message_t message)
+			{
+				unix_message_header header{ message, static_cast<uint32_t>(message.payload.size()) };
+
+				iovec buffers[]{
+					{ &header, sizeof(header) },
+					{ message.payload.data(), message.payload.size() },
+				};
+				co_await send_all(std::span{ buffers, message.payload.empty() ? 1u : 2u });
+			}
+
+			corsl::future<> write_batch(std::span<message_t> messages)
+			{
+				batch_headers.clear();
+				batch_buffers.clear();
+				for (const auto &message : messages)
+					batch_headers.push_back({ message, static_cast<uint32_t>(message.payload.size()) });
+				for (size_t i = 0; i < messages.size(); ++i)
+				{
+					batch_buffers.push_back({ &batch_headers[i], sizeof(unix_message_header) });
+					if (!messages[i].payload.empty())
+						batch_buffers.push_back({ messages[i].payload.data(), messages[i].payload.size() });
+				}
+				co_await send_all(batch_buffers);
+			}
+
+			corsl::future<> connect(const unix_config &config)
+			{
+				socket = posix::async_socket{ connect_socket(config.path) };
+				co_return;
+			}
+		};
+
+		class unix_listener
+		{
+			posix::async_socket listener;
+
+		public:
+			// A stale socket file at the path is removed
+			corsl::future<> create_server(const unix_config &config)
+			{
+				sockaddr_un address;
+				const auto length = make_address(config.path, address);
+				posix::file_descriptor fd{ posix::check_posix_api(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) };
+				if (config.path[0] != '@')
+					::unlink(config.path.c_str());
+				if (::bind(fd.get(), reinterpret_cast<const sockaddr *>(&address), length) != 0 || ::listen(fd.get(), SOMAXCONN) != 0)
+					posix::throw_last_error();
+
+				listener = posix::async_socket{ std::move(fd) };
+				co_return;
+			}
+
+			// Accepted connections are spread over the reactor threads
+			corsl::future<unix_transport> wait_client(const corsl::cancellation_source &cancel)
+			{
+				auto fd = co_await accept(cancel);
+				co_return unix_transport{ std::move(fd) };
+			}
+
+			corsl::future<posix::file_descriptor> accept(const corsl::cancellation_source &cancel)
+			{
+				corsl::cancellation_token token{ co_await cancel };
+				corsl::cancellation_subscription subscription{ token, [this]
+					{
+						listener.kick();
+					} };
+
+				for (;;)
+				{
+					if (const auto fd = ::accept4(listener.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); fd >= 0)
+						co_return posix::file_descriptor{ fd };
+					else if (errno == EAGAIN || errno == EWOULDBLOCK)
+						co_await listener.readable(cancel);
+					else if (errno != EINTR && errno != ECONNABORTED)
+						posix::throw_last_error();
+				}
+			}
+		};
+
+		static_assert(concepts::batch_transport<unix_transport>);
+		static_assert(concepts::batch_read_transport<unix_transport>);
+	}
+
+	namespace transports::unix_socket
+	{
+		using config_t = details::unix_socket::unix_config;
+		using details::unix_socket::unix_transport;
+		using details::unix_socket::unix_listener;
+	}
+}
@@ -0,0 +1,435 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "mapping.h"
+#include "socket.h"
+
+#include <cstdlib>
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+namespace crpc::posix
+{
+	// Receives the completion of an operation submitted to an io_ring. The address of the object is the user_data of the SQE,
+	// SQEs with zero user_data complete silently.
+	struct ring_completion
+	{
+		virtual void on_complete(const io_uring_cqe &cqe) noexcept = 0;
+	};
+
+	namespace impl
+	{
+		inline int io_uring_setup(unsigned entries, io_uring_params *params) noexcept
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+		}
+
+		inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+		}
+
+		inline int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) noexcept
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+		}
+
+		inline io_uring_sqe make_sqe(uint8_t opcode, int fd, const void *address, uint32_t length, ring_completion *completion = nullptr) noexcept
+		{
+			io_uring_sqe sqe{};
+			sqe.opcode = opcode;
+			sqe.fd = fd;
+			sqe.addr = reinterpret_cast<uint64_t>(address);
+			sqe.len = length;
+			sqe.user_data = reinterpret_cast<uint64_t>(completion);
+			return sqe;
+		}
+	}
+
+	class io_ring;
+
+	// A slice of the memory registered with a ring, suitable for IORING_OP_WRITE_FIXED
+	class fixed_buffer
+	{
+		io_ring *ring{};
+		std::span<std::byte> data;
+		uint16_t slot{};
+
+	public:
+		fixed_buffer() = default;
+		fixed_buffer(io_ring *ring, std::span<std::byte> data, uint16_t slot) noexcept :
+			ring{ ring },
+			data{ data },
+			slot{ slot }
+		{}
+
+		fixed_buffer(fixed_buffer &&o) noexcept :
+			ring{ std::exchange(o.ring, nullptr) },
+			data{ o.data },
+			slot{ o.slot }
+		{}
+
+		fixed_buffer &operator =(fixed_buffer &&o) noexcept
+		{
+			if (this != &o)
+			{
+				reset();
+				ring = std::exchange(o.ring, nullptr);
+				data = o.data;
+				slot = o.slot;
+			}
+			return *this;
+		}
+
+		~fixed_buffer()
+		{
+			reset();
+		}
+
+		inline void reset() noexcept;
+
+		explicit operator bool() const noexcept
+		{
+			return ring != nullptr;
+		}
+
+		std::byte *get() const noexcept
+		{
+			return data.data();
+		}
+
+		size_t size() const noexcept
+		{
+			return data.size();
+		}
+	};
+
+	// A raw io_uring instance with a thread dispatching its completions.
+	// Any thread may submit, submissions are serialized with a lock and pushed to the kernel immediately.
+	class io_ring
+	{
+		friend class fixed_buffer;
+
+		static constexpr const unsigned ring_entries = 256;
+		static constexpr const size_t fixed_slot_size = 4096;
+		static constexpr const uint16_t fixed_slot_count = 128;
+
+		file_descriptor fd;
+		impl::mapping rings, sqe_array, fixed_memory;
+
+		unsigned *sq_tail{}, sq_mask{};
+		io_uring_sqe *sqes{};
+		unsigned *cq_head{}, *cq_tail{}, cq_mask{};
+		const io_uring_cqe *cqes{};
+
+		std::mutex submit_lock;
+		std::mutex resources_lock;
+		std::vector<uint16_t> free_slots, free_groups;
+		uint16_t next_group{ 1 };
+
+		std::atomic<bool> stopping{};
+		std::jthread completion_thread;
+
+		static bool supports_operations(int fd)
+		{
+			constexpr const unsigned max_ops = 256;
+			std::vector<std::byte> storage(sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op));
+			auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+			if (impl::io_uring_register(fd, IORING_REGISTER_PROBE, probe, max_ops) < 0)
+				return false;
+
+			return std::ranges::all_of(std::initializer_list<uint8_t>{ IORING_OP_NOP, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_WRITE_FIXED, IORING_OP_CONNECT, IORING_OP_ASYNC_CANCEL }, [&](uint8_t op)
+				{
+					return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+				});
+		}
+
+		// provided buffer rings (and the multishot receive built on top of them) appeared in the same kernel release as fd-keyed cancellation
+		bool supports_buffer_rings()
+		{
+			impl::mapping memory{ sizeof(io_uring_buf) };
+			io_uring_buf_reg reg{};
+			reg.ring_addr = reinterpret_cast<uint64_t>(memory.at());
+			reg.ring_entries = 1;
+			if (!register_buffer_ring(reg))
+				return false;
+			unregister_buffer_ring(0);
+			return true;
+		}
+
+		void register_fixed_memory()
+		{
+			fixed_memory = impl::mapping{ fixed_slot_size * fixed_slot_count };
+			const iovec region{ fixed_memory.at(), fixed_memory.size() };
+			// registration is subject to RLIMIT_MEMLOCK, without it all writes go through IORING_OP_SEND
+			if (impl::io_uring_register(fd.get(), IORING_REGISTER_BUFFERS, &region, 1) < 0)
+				return;
+			free_slots.resize(fixed_slot_count);
+			for (uint16_t i = 0; i < fixed_slot_count; ++i)
+				free_slots[i] = static_cast<uint16_t>(fixed_slot_count - 1 - i);
+		}
+
+		void release_slot(uint16_t slot) noexcept
+		{
+			std::scoped_lock l{ resources_lock };
+			free_slots.push_back(slot);
+		}
+
+		void run()
+		{
+			while (!stopping.load(std::memory_order_acquire))
+			{
+				auto head = *cq_head;
+				const auto tail = std::atomic_ref{ *cq_tail }.load(std::memory_order_acquire);
+				if (head == tail)
+				{
+					if (impl::io_uring_enter(fd.get(), 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+						throw_last_error();
+					continue;
+				}
+
+				for (; head != tail; ++head)
+				{
+					const auto cqe = cqes[head & cq_mask];
+					std::atomic_ref{ *cq_head }.store(head + 1, std::memory_order_release);
+					if (auto *completion = reinterpret_cast<ring_completion *>(cqe.user_data))
+						completion->on_complete(cqe);
+				}
+			}
+		}
+
+	public:
+		// Throws hresult_error with E_NOTIMPL if the kernel lacks any of the required features
+		io_ring()
+		{
+			io_uring_params params{};
+			params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+			params.cq_entries = ring_entries * 8;
+			fd = file_descriptor{ check_posix_api(impl::io_uring_setup(ring_entries, &params)) };
+
+			constexpr const auto required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+			if ((params.features & required_features) != required_features || !supports_operations(fd.get()) || !supports_buffer_rings())
+				throw_error(E_NOTIMPL);
+
+			const auto rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+			rings = impl::mapping{ ::mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd.get(), IORING_OFF_SQ_RING), rings_size };
+			const auto sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			sqe_array = impl::mapping{ ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd.get(), IORING_OFF_SQES), sqes_size };
+			if (rings.at() == MAP_FAILED || sqe_array.at() == MAP_FAILED)
+				throw_last_error();
+
+			sq_tail = rings.at<unsigned>(params.sq_off.tail);
+			sq_mask = *rings.at<unsigned>(params.sq_off.ring_mask);
+			sqes = sqe_array.at<io_uring_sqe>();
+			// SQ slots are used in order, so the indirection array is the identity
+			auto *array = rings.at<unsigned>(params.sq_off.array);
+			for (unsigned i = 0; i < params.sq_entries; ++i)
+				array[i] = i;
+
+			cq_head = rings.at<unsigned>(params.cq_off.head);
+			cq_tail = rings.at<unsigned>(params.cq_off.tail);
+			cq_mask = *rings.at<unsigned>(params.cq_off.ring_mask);
+			cqes = rings.at<io_uring_cqe>(params.cq_off.cqes);
+
+			register_fixed_memory();
+			completion_thread = std::jthread{ [this] { run(); } };
+		}
+
+		io_ring(const io_ring &) = delete;
+		io_ring &operator =(const io_ring &) = delete;
+
+		~io_ring()
+		{
+			stopping.store(true, std::memory_order_release);
+			const auto wakeup = impl::make_sqe(IORING_OP_NOP, -1, nullptr, 0);
+			submit({ &wakeup, 1 });
+			completion_thread.join();
+		}
+
+		int get() const noexcept
+		{
+			return fd.get();
+		}
+
+		void submit(std::span<const io_uring_sqe> entries)
+		{
+			std::scoped_lock l{ submit_lock };
+			auto tail = *sq_tail;
+			for (const auto &entry : entries)
+				sqes[tail++ & sq_mask] = entry;
+			std::atomic_ref{ *sq_tail }.store(tail, std::memory_order_release);
+
+			for (auto pending = static_cast<unsigned>(entries.size()); pending;)
+			{
+				if (const auto r = impl::io_uring_enter(fd.get(), pending, 0, 0); r >= 0)
+					pending -= static_cast<unsigned>(r);
+				else if (errno == EAGAIN || errno == EBUSY)
+					std::this_thread::yield();
+				else if (errno != EINTR)
+					throw_last_error();
+			}
+		}
+
+		void submit(const io_uring_sqe &entry)
+		{
+			submit({ &entry, 1 });
+		}
+
+		// Returns an empty buffer if all slots are in use
+		fixed_buffer acquire_fixed_buffer() noexcept
+		{
+			std::scoped_lock l{ resources_lock };
+			if (free_slots.empty())
+				return {};
+			const auto slot = free_slots.back();
+			free_slots.pop_back();
+			return { this, { fixed_memory.at(slot * fixed_slot_size), fixed_slot_size }, slot };
+		}
+
+		uint16_t acquire_buffer_group()
+		{
+			std::scoped_lock l{ resources_lock };
+			if (!free_groups.empty())
+			{
+				const auto group = free_groups.back();
+				free_groups.pop_back();
+				return group;
+			}
+			if (next_group == 0)
+				throw_errno(ENOBUFS);
+			return next_group++;
+		}
+
+		void release_buffer_group(uint16_t group) noexcept
+		{
+			std::scoped_lock l{ resources_lock };
+			free_groups.push_back(group);
+		}
+
+		bool register_buffer_ring(const io_uring_buf_reg &reg) noexcept
+		{
+			return impl::io_uring_register(fd.get(), IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+		}
+
+		void unregister_buffer_ring(uint16_t group) noexcept
+		{
+			io_uring_buf_reg reg{};
+			reg.bgid = group;
+			impl::io_uring_register(fd.get(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		}
+	};
+
+	inline void fixed_buffer::reset() noexcept
+	{
+		if (auto *r = std::exchange(ring, nullptr))
+			r->release_slot(slot);
+	}
+
+	// Suspends until all N operations (usually linked) complete, returns their results
+	template<size_t N>
+	class ring_operation
+	{
+		struct entry final : ring_completion
+		{
+			ring_operation *owner;
+			int result;
+
+			void on_complete(const io_uring_cqe &cqe) noexcept override
+			{
+				result = cqe.res;
+				// the ring thread only reaps completions, the continuation runs on the background pool
+				if (--owner->remaining == 0)
+					background_pool().post(owner->continuation);
+			}
+		};
+
+		io_ring &ring;
+		std::array<io_uring_sqe, N> sqes;
+		std::array<entry, N> entries{};
+		size_t remaining{ N };
+		std::coroutine_handle<> continuation;
+
+	public:
+		ring_operation(io_ring &ring, const std::array<io_uring_sqe, N> &sqes) noexcept :
+			ring{ ring },
+			sqes{ sqes }
+		{}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			continuation = h;
+			for (size_t i = 0; i < N; ++i)
+			{
+				entries[i].owner = this;
+				sqes[i].user_data = reinterpret_cast<uint64_t>(&entries[i]);
+			}
+			ring.submit(sqes);
+		}
+
+		std::array<int, N> await_resume() const noexcept
+		{
+			std::array<int, N> results;
+			for (size_t i = 0; i < N; ++i)
+				results[i] = entries[i].result;
+			return results;
+		}
+	};
+
+	// One ring and completion thread per core. Connections are spread over rings round-robin.
+	class ring_pool
+	{
+		std::vector<std::unique_ptr<io_ring>> rings;
+		std::atomic<uint32_t> next_ring{};
+
+	public:
+		explicit ring_pool(unsigned count = default_concurrency())
+		{
+			rings.reserve(count);
+			while (count--)
+				rings.emplace_back(std::make_unique<io_ring>());
+		}
+
+		io_ring &pick() noexcept
+		{
+			return *rings[next_ring.fetch_add(1, std::memory_order_relaxed) % rings.size()];
+		}
+
+		size_t size() const noexcept
+		{
+			return rings.size();
+		}
+	};
+
+	// Returns nullptr if io_uring is not usable: too old a kernel, disabled by the system (kernel.io_uring_disabled or a seccomp filter)
+	// or by the CRPC_DISABLE_IO_URING environment variable. Leaked like reactors().
+	inline ring_pool *rings()
+	{
+		static ring_pool *pool = []() -> ring_pool *
+		{
+			if (std::getenv("CRPC_DISABLE_IO_URING"))
+				return nullptr;
+			try
+			{
+				return new ring_pool{};
+			}
+			catch (const hresult_error &)
+			{
+				return nullptr;
+			}
+		}();
+		return pool;
+	}
+}
@@ -0,0 +1,737 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "tcp_transport.h"
+#include "uring.h"
+
+#include <deque>
+#include <numeric>
+
+namespace crpc
+{
+	namespace details::uring
+	{
+		using tcp::tcp_config;
+		using tcp::tcp_message_header;
+
+		// A connected socket driven by an io_ring.
+		// Incoming data is received by a single multishot recv into a ring of buffers provided to the kernel.
+		// Outgoing messages are queued and written in batches, at most one batch is in flight at a time: messages that fit
+		// are packed into a registered buffer and written with IORING_OP_WRITE_FIXED, linked to a IORING_OP_SENDMSG gathering the rest.
+		// In steady state, neither direction costs more than a single io_uring_enter per batch.
+		class ring_socket final : public posix::ring_completion, public std::enable_shared_from_this<ring_socket>
+		{
+			static constexpr const uint16_t buffer_count = 16;
+			static constexpr const uint32_t buffer_size = 16384;
+			static constexpr const size_t max_batch = 64;
+			static constexpr const size_t max_queued_bytes = 4 * 1024 * 1024;
+
+			struct chunk
+			{
+				uint16_t id;
+				uint32_t begin, end;
+			};
+
+			struct outgoing
+			{
+				tcp_message_header header;
+				payload_t payload;
+			};
+
+			struct receive_starter final : posix::ring_completion
+			{
+				ring_socket *socket;
+
+				explicit receive_starter(ring_socket *socket) noexcept :
+					socket{ socket }
+				{}
+
+				void on_complete(const io_uring_cqe &) noexcept override
+				{
+					socket->submit_receive();
+				}
+			};
+
+			struct send_part final : posix::ring_completion
+			{
+				ring_socket *socket;
+				int result{};
+
+				explicit send_part(ring_socket *socket) noexcept :
+					socket{ socket }
+				{}
+
+				void on_complete(const io_uring_cqe &cqe) noexcept override
+				{
+					result = cqe.res;
+					socket->on_sent();
+				}
+			};
+
+			posix::io_ring &ring;
+			posix::file_descriptor fd;
+			std::atomic<bool> cancelled{};
+
+			// receive state
+			uint16_t group;
+			posix::impl::mapping buffer_ring;
+			std::unique_ptr<std::byte[]> buffers;
+
+			std::mutex lock;
+			std::deque<chunk> chunks;
+			std::coroutine_handle<> waiter;
+			int error{};
+			bool armed{}, multishot{ true };
+			// keeps the object alive while a receive is in flight
+			std::shared_ptr<ring_socket> self;
+			receive_starter starter{ this };
+
+			// send state
+			std::mutex send_lock;
+			std::deque<outgoing> queued;
+			size_t queued_bytes{};
+			std::vector<outgoing> sending;
+			posix::fixed_buffer packed;
+			size_t packed_size{};
+			std::vector<iovec> vectors;
+			msghdr vectors_header{};
+			send_part packed_part{ this }, vectors_part{ this };
+			unsigned parts_pending{};
+			int send_error{};
+			std::coroutine_handle<> send_waiter;
+			// keeps the object alive while a batch is in flight
+			std::shared_ptr<ring_socket> send_self;
+
+			std::byte *buffer(uint16_t id) const noexcept
+			{
+				return buffers.get() + size_t{ id } * buffer_size;
+			}
+
+			// must only be called by the reader
+			void recycle(uint16_t id) noexcept
+			{
+				// io_uring_buf_ring cannot be used from C++: its flexible array member is not laid out at offset 0.
+				// The ring tail overlays the reserved field of the first entry, so entries are filled field by field.
+				auto *entries = buffer_ring.at<io_uring_buf>();
+				auto &tail = entries[0].resv;
+				const uint16_t current = tail;
+				auto &entry = entries[current & (buffer_count - 1)];
+				entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+				entry.len = buffer_size;
+				entry.bid = id;
+				std::atomic_ref{ tail }.store(static_cast<uint16_t>(current + 1), std::memory_order_release);
+			}
+
+			// must be called under lock. Returns true if the caller must start the receive.
+			bool prepare_receive()
+			{
+				if (armed || error || cancelled.load(std::memory_order_relaxed))
+					return false;
+				armed = true;
+				self = shared_from_this();
+				return true;
+			}
+
+			void receive_failed() noexcept
+			{
+				std::shared_ptr<ring_socket> keep_alive;
+				std::scoped_lock l{ lock };
+				armed = false;
+				error = EIO;
+				keep_alive = std::move(self);
+			}
+
+			// Must be called on the ring thread: completions of a receive waiting for data are delivered through the task that submitted it,
+			// and the ring thread is always ready to run them.
+			void submit_receive() noexcept
+			{
+				auto sqe = posix::impl::make_sqe(IORING_OP_RECV, fd.get(), nullptr, 0, this);
+				sqe.flags = IOSQE_BUFFER_SELECT;
+				sqe.buf_group = group;
+				if (multishot)
+					sqe.ioprio = IORING_RECV_MULTISHOT;
+				try
+				{
+					ring.submit(sqe);
+				}
+				catch (const posix::hresult_error &)
+				{
+					receive_failed();
+				}
+			}
+
+			// Hands the receive over to the ring thread with a no-op
+			void start_receive() noexcept
+			{
+				try
+				{
+					ring.submit(posix::impl::make_sqe(IORING_OP_NOP, -1, nullptr, 0, &starter));
+				}
+				catch (const posix::hresult_error &)
+				{
+					receive_failed();
+				}
+			}
+
+			void on_complete(const io_uring_cqe &cqe) noexcept override
+			{
+				std::shared_ptr<ring_socket> keep_alive;
+				std::coroutine_handle<> h;
+				bool rearm{};
+				{
+					std::scoped_lock l{ lock };
+					if (cqe.res > 0)
+						chunks.push_back({ static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 0, static_cast<uint32_t>(cqe.res) });
+
+					if (!(cqe.flags & IORING_CQE_F_MORE))
+					{
+						armed = false;
+						keep_alive = std::move(self);
+						if (cqe.res == -EINVAL && multishot)
+							multishot = false;		// kernel has buffer rings, but not multishot receive
+						else if (cqe.res == 0)
+							error = ECONNRESET;
+						else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+							error = -cqe.res;
+
+						// the reader restarts the receive when it returns buffers to the kernel
+						if (cqe.res != -ENOBUFS)
+							rearm = prepare_receive();
+					}
+					h = std::exchange(waiter, {});
+				}
+
+				if (rearm)
+					submit_receive();
+				if (h)
+					posix::background_pool().post(h);
+			}
+
+			// must be called under send_lock
+			bool can_queue() const noexcept
+			{
+				return queued_bytes <= max_queued_bytes || send_error || cancelled.load(std::memory_order_relaxed);
+			}
+
+			// must be called under send_lock
+			void fail_sends(int code) noexcept
+			{
+				send_error = code;
+				sending.clear();
+				queued.clear();
+				queued_bytes = 0;
+				packed.reset();
+				packed_size = 0;
+				parts_pending = 0;
+			}
+
+			// must be called under send_lock
+			void submit_batch(std::span<const io_uring_sqe> sqes) noexcept
+			{
+				parts_pending = static_cast<unsigned>(sqes.size());
+				send_self = shared_from_this();
+				try
+				{
+					ring.submit(sqes);
+				}
+				catch (const posix::hresult_error &)
+				{
+					fail_sends(EIO);
+				}
+			}
+
+			io_uring_sqe make_sendmsg() noexcept
+			{
+				vectors_header.msg_iov = vectors.data();
+				vectors_header.msg_iovlen = vectors.size();
+				auto sqe = posix::impl::make_sqe(IORING_OP_SENDMSG, fd.get(), &vectors_header, 1, &vectors_part);
+				sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+				return sqe;
+			}
+
+			// must be called under send_lock with no batch in flight and a non-empty queue
+			void start_batch() noexcept
+			{
+				const auto count = std::min(queued.size(), max_batch);
+				for (size_t i = 0; i < count; ++i)
+				{
+					queued_bytes -= queued.front().payload.size();
+					sending.push_back(std::move(queued.front()));
+					queued.pop_front();
+				}
+
+				// pack the leading messages that fit entirely into a registered buffer
+				size_t index{};
+				if ((packed = ring.acquire_fixed_buffer()))
+				{
+					for (; index < count; ++index)
+					{
+						const auto &message = sending[index];
+						if (packed_size + sizeof(message.header) + message.payload.size() > packed.size())
+							break;
+						std::memcpy(packed.get() + packed_size, &message.header, sizeof(message.header));
+						std::memcpy(packed.get() + packed_size + sizeof(message.header), message.payload.data(), message.payload.size());
+						packed_size += sizeof(message.header) + message.payload.size();
+					}
+					if (!packed_size)
+						packed.reset();
+				}
+
+				vectors.clear();
+				for (; index < count; ++index)
+				{
+					auto &message = sending[index];
+					vectors.push_back({ &message.header, sizeof(message.header) });
+					if (!message.payload.empty())
+						vectors.push_back({ message.payload.data(), message.payload.size() });
+				}
+
+				std::array<io_uring_sqe, 2> sqes;
+				size_t sqe_count{};
+				if (packed_size)
+				{
+					auto &sqe = sqes[sqe_count++];
+					sqe = posix::impl::make_sqe(IORING_OP_WRITE_FIXED, fd.get(), packed.get(), static_cast<uint32_t>(packed_size), &packed_part);
+					sqe.buf_index = 0;
+					if (!vectors.empty())
+						sqe.flags = IOSQE_IO_LINK;
+				}
+				if (!vectors.empty())
+					sqes[sqe_count++] = make_sendmsg();
+				submit_batch({ sqes.data(), sqe_count });
+			}
+
+			// must be called under send_lock. Returns false if the rest of the batch has been resubmitted.
+			bool complete_batch() noexcept
+			{
+				const auto vectors_size = std::accumulate(vectors.begin(), vectors.end(), size_t{}, [](size_t total, const iovec &v)
+					{
+						return total + v.iov_len;
+					});
+				const auto packed_result = packed_size ? packed_part.result : 0;
+				const auto vectors_result = vectors_size ? vectors_part.result : 0;
+
+				if (packed_result < 0 || (vectors_result < 0 && (vectors_result != -ECANCELED || static_cast<size_t>(packed_result) == packed_size)))
+				{
+					fail_sends(packed_result < 0 ? -packed_result : -vectors_result);
+					return true;
+				}
+
+				// a stream socket may accept a write partially, which also cancels the linked send
+				const auto packed_sent = static_cast<size_t>(packed_result);
+				const auto vectors_sent = static_cast<size_t>(std::max(vectors_result, 0));
+				if (packed_sent < packed_size || vectors_sent < vectors_size)
+				{
+					std::vector<iovec> rest;
+					auto skip = vectors_sent;
+					if (packed_sent < packed_size)
+						rest.push_back({ packed.get() + packed_sent, packed_size - packed_sent });
+					for (const auto &v : vectors)
+					{
+						if (skip >= v.iov_len)
+							skip -= v.iov_len;
+						else
+						{
+							rest.push_back({ static_cast<std::byte *>(v.iov_base) + skip, v.iov_len - skip });
+							skip = 0;
+						}
+					}
+					// the registered buffer, if any, is kept until the batch is done
+					vectors = std::move(rest);
+					packed_size = 0;
+					const auto sqe = make_sendmsg();
+					submit_batch({ &sqe, 1 });
+					return false;
+				}
+
+				sending.clear();
+				packed.reset();
+				packed_size = 0;
+				return true;
+			}
+
+			void on_sent() noexcept
+			{
+				std::shared_ptr<ring_socket> keep_alive;
+				std::coroutine_handle<> h;
+				{
+					std::scoped_lock l{ send_lock };
+					if (--parts_pending || !complete_batch())
+						return;
+					if (!queued.empty() && !send_error)
+						start_batch();
+					if (!parts_pending)
+						keep_alive = std::move(send_self);
+					if (can_queue())
+						h = std::exchange(send_waiter, {});
+				}
+				if (h)
+					posix::background_pool().post(h);
+			}
+
+		public:
+			ring_socket(posix::io_ring &ring, posix::file_descriptor &&fd) :
+				ring{ ring },
+				fd{ std::move(fd) },
+				group{ ring.acquire_buffer_group() },
+				buffer_ring{ buffer_count * sizeof(io_uring_buf) },
+				buffers{ std::make_unique_for_overwrite<std::byte[]>(size_t{ buffer_count } * buffer_size) }
+			{
+				io_uring_buf_reg reg{};
+				reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring.at());
+				reg.ring_entries = buffer_count;
+				reg.bgid = group;
+				if (!ring.register_buffer_ring(reg))
+				{
+					ring.release_buffer_group(group);
+					posix::throw_last_error();
+				}
+				for (uint16_t id = 0; id < buffer_count; ++id)
+					recycle(id);
+			}
+
+			~ring_socket()
+			{
+				ring.unregister_buffer_ring(group);
+				ring.release_buffer_group(group);
+			}
+
+			// Wakes the reader and the writer and aborts all operations in flight for the socket
+			void cancel() noexcept
+			{
+				std::coroutine_handle<> h, send_h;
+				{
+					std::scoped_lock l{ lock };
+					cancelled.store(true, std::memory_order_relaxed);
+					h = std::exchange(waiter, {});
+				}
+				{
+					std::scoped_lock l{ send_lock };
+					send_h = std::exchange(send_waiter, {});
+				}
+				auto sqe = posix::impl::make_sqe(IORING_OP_ASYNC_CANCEL, fd.get(), nullptr, 0);
+				sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+				try
+				{
+					ring.submit(sqe);
+				}
+				catch (const posix::hresult_error &)
+				{
+				}
+				if (h)
+					posix::background_pool().post(h);
+				if (send_h)
+					posix::background_pool().post(send_h);
+			}
+
+			// Copies received data into out, starting at filled, and returns provided buffers to the kernel as they are drained.
+			// Returns false if more data must be awaited.
+			bool consume(std::span<std::byte> out, size_t &filled)
+			{
+				while (filled < out.size())
+				{
+					std::optional<chunk> current;
+					bool rearm{};
+					{
+						std::scoped_lock l{ lock };
+						if (cancelled.load(std::memory_order_relaxed))
+							throw corsl::operation_cancelled{};
+						if (!chunks.empty())
+							current = chunks.front();
+						else if (error)
+							posix::throw_errno(error);
+						else
+							rearm = prepare_receive();
+					}
+
+					if (!current)
+					{
+						if (rearm)
+							start_receive();
+						return false;
+					}
+
+					const auto size = std::min<size_t>(current->end - current->begin, out.size() - filled);
+					std::memcpy(out.data() + filled, buffer(current->id) + current->begin, size);
+					filled += size;
+
+					{
+						std::scoped_lock l{ lock };
+						auto &front = chunks.front();
+						if ((front.begin += static_cast<uint32_t>(size)) == front.end)
+						{
+							chunks.pop_front();
+							recycle(current->id);
+							// restarts a receive stopped by running out of buffers
+							rearm = prepare_receive();
+						}
+					}
+					if (rearm)
+						start_receive();
+				}
+				return true;
+			}
+
+			auto readable() noexcept
+			{
+				struct awaiter
+				{
+					ring_socket &socket;
+
+					bool is_ready() const noexcept
+					{
+						return !socket.chunks.empty() || socket.error || socket.cancelled.load(std::memory_order_relaxed);
+					}
+
+					bool await_ready() const
+					{
+						std::scoped_lock l{ socket.lock };
+						return is_ready();
+					}
+
+					bool await_suspend(std::coroutine_handle<> h)
+					{
+						std::scoped_lock l{ socket.lock };
+						if (is_ready())
+							return false;
+						socket.waiter = h;
+						return true;
+					}
+
+					void await_resume() const noexcept
+					{}
+				};
+
+				return awaiter{ *this };
+			}
+
+			// Queues the message for sending. Errors of previously queued messages are reported here.
+			void enqueue(const message_header &header, payload_t &&payload)
+			{
+				std::scoped_lock l{ send_lock };
+				if (cancelled.load(std::memory_order_relaxed))
+					throw corsl::operation_cancelled{};
+				if (send_error)
+					posix::throw_errno(send_error);
+
+				queued_bytes += payload.size();
+				queued.push_back({ { header, static_cast<uint32_t>(payload.size()) }, std::move(payload) });
+				if (!parts_pending)
+					start_batch();
+			}
+
+			// Suspends while too much data is queued. Only a single writer may wait at a time.
+			auto queue_available() noexcept
+			{
+				struct awaiter
+				{
+					ring_socket &socket;
+
+					bool await_ready() const
+					{
+						std::scoped_lock l{ socket.send_lock };
+						return socket.can_queue();
+					}
+
+					bool await_suspend(std::coroutine_handle<> h)
+					{
+						std::scoped_lock l{ socket.send_lock };
+						if (socket.can_queue())
+							return false;
+						socket.send_waiter = h;
+						return true;
+					}
+
+					void await_resume() const
+					{
+						if (socket.cancelled.load(std::memory_order_relaxed))
+							throw corsl::operation_cancelled{};
+					}
+				};
+
+				return awaiter{ *this };
+			}
+		};
+
+		struct socket_canceller
+		{
+			ring_socket *socket;
+
+			void operator()() const noexcept
+			{
+				socket->cancel();
+			}
+		};
+
+		// TCP transport over io_uring, using the same framing as tcp_transport.
+		// If io_uring is not available, the transport transparently falls back to the epoll-based tcp_transport.
+		class uring_transport
+		{
+			corsl::cancellation_source cancel;
+			std::shared_ptr<ring_socket> socket;
+			std::unique_ptr<corsl::cancellation_subscription<socket_canceller>> subscription;
+			tcp::tcp_transport fallback;
+
+			void close() noexcept
+			{
+				subscription.reset();
+				if (socket)
+				{
+					socket->cancel();
+					socket.reset();
+				}
+			}
+
+		public:
+			uring_transport() = default;
+
+			explicit uring_transport(posix::file_descriptor &&fd)
+			{
+				tcp::set_socket_options(fd.get());
+				if (auto *pool = posix::rings())
+					socket = std::make_shared<ring_socket>(pool->pick(), std::move(fd));
+				else
+					fallback = tcp::tcp_transport{ std::move(fd) };
+			}
+
+			uring_transport(uring_transport &&) = default;
+
+			uring_transport &operator =(uring_transport &&o) noexcept
+			{
+				if (this != &o)
+				{
+					close();
+					cancel = std::move(o.cancel);
+					socket = std::move(o.socket);
+					subscription = std::move(o.subscription);
+					fallback = std::move(o.fallback);
+				}
+				return *this;
+			}
+
+			~uring_transport()
+			{
+				close();
+			}
+
+			// Returns true if the transport runs over io_uring rather than the epoll fallback
+			bool is_native() const noexcept
+			{
+				return static_cast<bool>(socket);
+			}
+
+			void set_cancellation_token(const corsl::cancellation_source &src)
+			{
+				if (!socket)
+					return fallback.set_cancellation_token(src);
+				cancel = src.create_connected_source();
+				subscription = std::make_unique<corsl::cancellation_subscription<socket_canceller>>(cancel.get_token(), socket_canceller{ socket.get() });
+			}
+
+			corsl::future<message_t> read()
+			{
+				if (!socket)
+					co_return co_await fallback.read();
+
+				tcp_message_header header;
+				const auto header_bytes = std::as_writable_bytes(std::span{ &header, 1 });
+				size_t filled{};
+				while (!socket->consume(header_bytes, filled))
+					co_await socket->readable();
+
+				payload_t payload(header.payload_size);
+				filled = 0;
+				while (!socket->consume(payload, filled))
+					co_await socket->readable();
+
+				co_return message_t{ header, std::move(payload) };
+			}
+
+			// Completes once the message is queued, a failure to send it is reported by a subsequent write
+			corsl::future<> write(message_t message)
+			{
+				if (!socket)
+					co_return co_await fallback.write(std::move(message));
+
+				socket->enqueue(message, std::move(message.payload));
+				co_await socket->queue_available();
+			}
+
+			corsl::future<> connect(const tcp_config &config)
+			{
+				auto *pool = posix::rings();
+				if (!pool)
+					co_return co_await fallback.connect(config);
+
+				const auto addresses = posix::impl::resolve(config.address, config.port, false);
+				int last_error = ECONNREFUSED;
+				for (auto *ai = addresses.get(); ai; ai = ai->ai_next)
+				{
+					posix::file_descriptor fd{ ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol) };
+					if (!fd)
+					{
+						last_error = errno;
+						continue;
+					}
+					tcp::set_socket_options(fd.get());
+					auto &ring = pool->pick();
+					auto sqe = posix::impl::make_sqe(IORING_OP_CONNECT, fd.get(), ai->ai_addr, 0);
+					sqe.off = ai->ai_addrlen;
+					posix::ring_operation<1> operation{ ring, { sqe } };
+					if (const auto [result] = co_await operation; result < 0)
+					{
+						last_error = -result;
+						continue;
+					}
+					socket = std::make_shared<ring_socket>(ring, std::move(fd));
+					co_return;
+				}
+				posix::throw_errno(last_error);
+			}
+		};
+
+		// Accepts connections with the epoll-based tcp_listener, accepted sockets are handed over to io_uring
+		class uring_listener
+		{
+			tcp::tcp_listener listener;
+
+		public:
+			corsl::future<> create_server(const tcp_config &config)
+			{
+				return listener.create_server(config);
+			}
+
+			corsl::future<int> create_server()
+			{
+				return listener.create_server();
+			}
+
+			corsl::future<uring_transport> wait_client(const corsl::cancellation_source &cancel)
+			{
+				auto fd = co_await listener.accept(cancel);
+				co_return uring_transport{ std::move(fd) };
+			}
+
+			int get_port() const noexcept
+			{
+				return listener.get_port();
+			}
+		};
+
+		static_assert(concepts::transport<uring_transport>);
+	}
+
+	namespace transports::uring
+	{
+		using config_t = details::tcp::tcp_config;
+		using details::uring::uring_transport;
+		using details::uring::uring_listener;
+	}
+}
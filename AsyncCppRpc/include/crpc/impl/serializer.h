@@ -9,6 +9,7 @@
 #pragma once
 
 #include "dependencies.h"
+#include "payload_pool.h"
 #include "cista_reflection/to_tuple.h"
 
 namespace crpc
@@ -32,6 +33,214 @@ namespace crpc
 			serialize_write(w, v);
 		};
 
+		template<class T, class Reader>
+		concept supports_custom_read_internal = requires(T & v, Reader & r)
+		{
+			v.serialize_read(r);
+		};
+
+		template<class T, class Reader>
+		concept supports_custom_read_external = requires(T & v, Reader & r)
+		{
+			serialize_read(r, v);
+		};
+
+		template<class T, class Serializer>
+		concept supports_custom_serialization = supports_custom_write_internal<T, Serializer> || supports_custom_write_external<T, Serializer> ||
+			supports_custom_read_internal<T, Serializer> || supports_custom_read_external<T, Serializer>;
+
+		// trivially copyable types that nevertheless have their own serialization format
+		template<class T>
+		concept has_dedicated_format = mp11::mp_similar<T, std::optional<int>>::value || mp11::mp_similar<T, std::expected<int, int>>::value ||
+			mp11::mp_similar<T, std::variant<int>>::value || mp11::mp_similar<T, std::pair<int, int>>::value ||
+			mp11::mp_similar<T, std::tuple<>>::value || std::same_as<T, std::error_code>;
+
+		template<class T, class D>
+		using member_type_t = std::remove_cvref_t<decltype(std::declval<const T &>().*D::pointer)>;
+
+		template<class T>
+		using described_members_t = boost::describe::describe_members<T, boost::describe::mod_any_access>;
+
+		// A serializer state type deriving from `compact_encoding` writes integers wider than a byte (other than characters),
+		// enumerations based on them, and therefore all lengths and variant indices, as LEB128 varints, zig-zag encoding
+		// signed values. Both sides must use the same encoding.
+		struct compact_encoding
+		{
+			static constexpr const bool compact_integers = true;
+		};
+
+		template<class State>
+		inline consteval bool is_compact() noexcept
+		{
+			if constexpr (requires { State::compact_integers; })
+				return State::compact_integers;
+			else
+				return false;
+		}
+
+		template<class T>
+		inline consteval bool is_varint_type() noexcept
+		{
+			if constexpr (std::is_enum_v<T>)
+				return is_varint_type<std::underlying_type_t<T>>();
+			else
+				return std::integral<T> && sizeof(T) > 1 && !std::same_as<T, wchar_t> && !std::same_as<T, char16_t> && !std::same_as<T, char32_t>;
+		}
+
+		template<class T, class State>
+		concept varint_encoded = is_compact<State>() && is_varint_type<T>();
+
+		template<class T>
+		inline constexpr uint64_t to_varint(T val) noexcept
+		{
+			if constexpr (std::is_enum_v<T>)
+				return to_varint(std::to_underlying(val));
+			else if constexpr (std::is_signed_v<T>)
+			{
+				using U = std::make_unsigned_t<T>;
+				return static_cast<U>(static_cast<U>(static_cast<U>(val) << 1) ^ static_cast<U>(val >> (sizeof(T) * 8 - 1)));
+			}
+			else
+				return val;
+		}
+
+		template<class T>
+		inline constexpr T from_varint(uint64_t val) noexcept
+		{
+			if constexpr (std::is_enum_v<T>)
+				return static_cast<T>(from_varint<std::underlying_type_t<T>>(val));
+			else if constexpr (std::is_signed_v<T>)
+			{
+				using U = std::make_unsigned_t<T>;
+				const auto u = static_cast<U>(val);
+				return static_cast<T>(static_cast<U>(u >> 1) ^ static_cast<U>(-static_cast<U>(u & 1)));
+			}
+			else
+				return static_cast<T>(val);
+		}
+
+		inline constexpr size_t varint_size(uint64_t val) noexcept
+		{
+			return (std::bit_width(val | 1) + 6) / 7;
+		}
+
+		inline size_t encode_varint(uint64_t val, std::byte *out) noexcept
+		{
+			size_t size{};
+			for (; val >= 0x80; val >>= 7)
+				out[size++] = static_cast<std::byte>(val | 0x80);
+			out[size++] = static_cast<std::byte>(val);
+			return size;
+		}
+
+		inline size_t decode_varint(const std::byte *in, uint64_t &val) noexcept
+		{
+			val = 0;
+			size_t size{};
+			for (unsigned shift = 0; shift < 64; shift += 7)
+			{
+				const auto b = std::to_integer<uint64_t>(in[size++]);
+				val |= (b & 0x7f) << shift;
+				if (!(b & 0x80))
+					break;
+			}
+			return size;
+		}
+
+		inline constexpr const uint64_t varint_continuation_bits = 0x8080808080808080ull;
+
+		// Decodes a varint of up to 8 bytes from the 8 bytes at `in` without a branch per byte. Returns the number
+		// of bytes used, or 0 if the value is longer.
+		inline size_t decode_varint8(const std::byte *in, uint64_t &val) noexcept
+		{
+			if constexpr (std::endian::native != std::endian::little)
+				return 0;
+			else
+			{
+				uint64_t word;
+				std::memcpy(&word, in, sizeof(word));
+				const auto stops = ~word & varint_continuation_bits;
+				if (!stops)
+					return 0;
+				word &= (stops ^ (stops - 1)) & 0x7f7f7f7f7f7f7f7full;
+				word = ((word & 0x7f007f007f007f00ull) >> 1) | (word & 0x007f007f007f007full);
+				word = ((word & 0x3fff00003fff0000ull) >> 2) | (word & 0x00003fff00003fffull);
+				word = ((word & 0x0fffffff00000000ull) >> 4) | (word & 0x000000000fffffffull);
+				val = word;
+				return static_cast<size_t>(std::countr_zero(stops) / 8 + 1);
+			}
+		}
+
+		// Whether `Serializer` stores `T` as its object representation. A described type qualifies when all its members
+		// do and they leave no padding; it must also pass `is_dense`, which checks that they are described in declaration order.
+		template<class T, class Serializer>
+		constexpr bool is_bitwise() noexcept
+		{
+			if constexpr (supports_custom_serialization<T, Serializer> || has_dedicated_format<T> || sr::common_range<T> || !std::is_trivially_copyable_v<T> ||
+				varint_encoded<T, typename Serializer::StoredState>)
+				return false;
+			else if constexpr (boost::describe::has_describe_members<T>::value)
+			{
+				bool bitwise = true;
+				size_t size{};
+				mp11::mp_for_each<described_members_t<T>>([&]<class D>(D)
+				{
+					bitwise = bitwise && is_bitwise<member_type_t<T, D>, Serializer>();
+					size += sizeof(member_type_t<T, D>);
+				});
+				return bitwise && size == sizeof(T);
+			}
+			else
+				return true;
+		}
+
+		// Whether the members of a described `T` follow each other in memory in the order they are serialized.
+		// The layout is the same for every object, so it is checked once, on the first `val` passed.
+		template<class T>
+		inline bool is_dense(const T &val) noexcept
+		{
+			if constexpr (boost::describe::has_describe_members<T>::value)
+			{
+				static const bool dense = [&]
+				{
+					const auto *base = reinterpret_cast<const std::byte *>(std::addressof(val));
+					bool result = true;
+					size_t offset{};
+					mp11::mp_for_each<described_members_t<T>>([&]<class D>(D)
+					{
+						const auto &member = val.*D::pointer;
+						result = result && reinterpret_cast<const std::byte *>(std::addressof(member)) == base + offset && is_dense(member);
+						offset += sizeof(member);
+					});
+					return result;
+				}();
+				return dense;
+			}
+			else
+				return true;
+		}
+
+		// Adjacent members copied with a single operation
+		template<class Byte>
+		struct member_run
+		{
+			Byte *begin{};
+			size_t size{};
+
+			// Returns false if `member` does not continue the run
+			template<class T>
+			bool extend(T &member) noexcept
+			{
+				auto *p = reinterpret_cast<Byte *>(std::addressof(member));
+				if (size && begin + size != p)
+					return false;
+				if (!size)
+					begin = p;
+				size += sizeof(T);
+				return true;
+			}
+		};
+
 		template<class T>
 		concept has_emplace_back = requires(T & v, typename T::value_type &&p)
 		{
@@ -81,24 +290,218 @@ namespace crpc
 			static constexpr const bool has_state = false;
 		};
 
-		template<class State = empty_serializer_state>
+		// A serializer state type deriving from `aligned_framing` places the elements of length-prefixed arrays
+		// (including strings) of trivially copyable types on `Alignment`-byte boundaries within the payload, padding
+		// after the length as needed, so the receiver can view them in place. Both sides must use the same framing.
+		template<size_t Alignment = 16>
+		struct aligned_framing
+		{
+			static_assert(std::has_single_bit(Alignment), "Alignment must be a power of two");
+			static constexpr const size_t array_alignment = Alignment;
+		};
+
+		template<class State>
+		inline consteval size_t get_array_alignment() noexcept
+		{
+			if constexpr (requires { State::array_alignment; })
+				return State::array_alignment;
+			else
+				return 1;
+		}
+
+		// Padding that places an array of `T` at `offset` on the framing's alignment
+		template<class State, class T>
+		inline constexpr size_t array_padding(size_t offset) noexcept
+		{
+			constexpr auto alignment = get_array_alignment<State>();
+			if constexpr (alignment > 1 && alignof(T) > 1)
+				return (alignment - offset % alignment) % alignment;
+			else
+				return 0;
+		}
+
+		// With `SizeOnly`, the writer only counts the bytes it would write, see `serialized_size`
+		template<class State = empty_serializer_state, bool SizeOnly = false>
 		class Writer : public state_holder<State>
 		{
-			using Container = std::vector<std::byte>;
-			using state_holder = state_holder<State>;
+			template<class, bool>
+			friend class Writer;
+
+			using Container = payload_t;
+			using holder_t = state_holder<State>;
 
 			Container storage;
+			size_t counted{};
 
 			void add(const std::byte *begin, std::size_t size)
 			{
-				storage.insert(storage.end(), begin, begin + size);
+				if constexpr (SizeOnly)
+					counted += size;
+				else
+					storage.insert(storage.end(), begin, begin + size);
+			}
+
+			// custom serialization that only accepts a regular writer is measured by running it,
+			// at the same offset modulo the framing's alignment
+			template<class T>
+			void measure(const T &val)
+			{
+				const auto start = counted % get_array_alignment<State>();
+				auto w = [&]
+				{
+					if constexpr (holder_t::has_state)
+						return Writer<State>{ holder_t::state };
+					else
+						return Writer<State>{};
+				}();
+				w.storage.resize(start);
+				w << val;
+				counted += w.size() - start;
+			}
+
+			void flush(member_run<const std::byte> &run)
+			{
+				if (run.size)
+					add(run.begin, run.size);
+				run = {};
+			}
+
+			// custom serialization is looked up for a regular writer, see `measure`
+			template<class T>
+			void write_member(const T &member, member_run<const std::byte> &run)
+			{
+				if constexpr (is_bitwise<T, Writer<State>>())
+				{
+					if (is_dense(member))
+					{
+						if (!run.extend(member))
+						{
+							flush(run);
+							run.extend(member);
+						}
+						return;
+					}
+				}
+				flush(run);
+				write(member);
+			}
+
+			template<class...Members>
+			void write_members(const Members &...members)
+			{
+				member_run<const std::byte> run;
+				(..., write_member(members, run));
+				flush(run);
+			}
+
+			template<class T>
+			void write_varint(T val)
+			{
+				const auto value = to_varint(val);
+				if constexpr (SizeOnly)
+					counted += varint_size(value);
+				else
+				{
+					std::byte buffer[10];
+					add(buffer, encode_varint(value, buffer));
+				}
+			}
+
+			// ranges of these types are copied in one go
+			template<class T>
+			static constexpr bool is_bulk() noexcept
+			{
+				if constexpr (is_compact<State>())
+					return is_bitwise<T, Writer<State>>();
+				else
+					return std::is_trivially_copyable_v<T>;
+			}
+
+			// Whether sizing `T` costs a few additions: no custom serialization has to run, and no range has to be visited
+			// element by element. Overloads mirror the `write` overloads below.
+			template<class T>
+			static consteval bool is_cheap_to_size(std::type_identity<T>) noexcept
+			{
+				if constexpr (supports_custom_write_internal<T, Writer<State>> || supports_custom_write_external<T, Writer<State>> ||
+					supports_custom_write_internal<T, Writer<State, true>> || supports_custom_write_external<T, Writer<State, true>>)
+					return false;
+				else if constexpr (boost::describe::has_describe_members<T>::value)
+				{
+					bool cheap = true;
+					mp11::mp_for_each<described_members_t<T>>([&]<class D>(D)
+					{
+						cheap = cheap && is_cheap_to_size(std::type_identity<member_type_t<T, D>>{});
+					});
+					return cheap;
+				}
+				else if constexpr (sr::common_range<T>)
+					return is_bulk<sr::range_value_t<T>>();
+				else if constexpr (varint_encoded<T, State> || std::is_trivially_copyable_v<T>)
+					return true;
+				else
+					return is_cheap_to_size(std::type_identity<decltype(cista::to_tuple(std::declval<const T &>()))>{});
+			}
+
+			template<class T, class Alloc>
+			static consteval bool is_cheap_to_size(std::type_identity<std::vector<T, Alloc>>) noexcept
+			{
+				return is_bulk<T>();
+			}
+
+			template<class Char, class Traits, class Alloc>
+			static consteval bool is_cheap_to_size(std::type_identity<std::basic_string<Char, Traits, Alloc>>) noexcept
+			{
+				return true;
+			}
+
+			template<class Char, class Traits>
+			static consteval bool is_cheap_to_size(std::type_identity<std::basic_string_view<Char, Traits>>) noexcept
+			{
+				return true;
+			}
+
+			template<class T>
+			static consteval bool is_cheap_to_size(std::type_identity<std::optional<T>>) noexcept
+			{
+				return is_cheap_to_size(std::type_identity<T>{});
+			}
+
+			template<class V, class E>
+			static consteval bool is_cheap_to_size(std::type_identity<std::expected<V, E>>) noexcept
+			{
+				return is_cheap_to_size(std::type_identity<V>{}) && is_cheap_to_size(std::type_identity<E>{});
+			}
+
+			template<class P1, class P2>
+			static consteval bool is_cheap_to_size(std::type_identity<std::pair<P1, P2>>) noexcept
+			{
+				return is_cheap_to_size(std::type_identity<P1>{}) && is_cheap_to_size(std::type_identity<P2>{});
+			}
+
+			template<class...Ts>
+			static consteval bool is_cheap_to_size(std::type_identity<std::tuple<Ts...>>) noexcept
+			{
+				return (is_cheap_to_size(std::type_identity<std::remove_cvref_t<Ts>>{}) && ...);
+			}
+
+			template<class...Ts>
+			static consteval bool is_cheap_to_size(std::type_identity<std::variant<Ts...>>) noexcept
+			{
+				return (is_cheap_to_size(std::type_identity<Ts>{}) && ...);
 			}
 
 			template<class Iterator, class Sentinel>
 			void write(const Iterator &begin, const Sentinel &end, std::true_type)
 			{
 				if (begin != end)
+				{
+					if (const auto padding = array_padding<State, std::iter_value_t<Iterator>>(size()))
+					{
+						static constexpr const std::byte zeros[get_array_alignment<State>()]{};
+						add(zeros, padding);
+					}
 					add(reinterpret_cast<const std::byte *>(std::addressof(*begin)), sizeof(*begin) * std::distance(begin, end));
+				}
 			}
 
 			template<class Iterator, class Sentinel>
@@ -193,7 +596,7 @@ namespace crpc
 			{
 				using value_type = sr::range_value_t<T>;
 				write(static_cast<uint32_t>(val.size()));
-				write(sr::begin(val), sr::end(val), std::is_trivially_copyable<value_type>{});
+				write(sr::begin(val), sr::end(val), std::bool_constant<is_bulk<value_type>()>{});
 			}
 
 			// generic object write
@@ -208,41 +611,57 @@ namespace crpc
 				{
 					serialize_write(*this, val);
 				}
+				else if constexpr (SizeOnly && (supports_custom_write_internal<T, Writer<State>> || supports_custom_write_external<T, Writer<State>>))
+				{
+					measure(val);
+				}
 				else if constexpr (boost::describe::has_describe_members<T>::value)
 				{
-					mp11::mp_for_each<boost::describe::describe_members<T, boost::describe::mod_any_access>>([&]<typename D>(D)
+					if (is_bitwise<T, Writer<State>>() && is_dense(val))
+						add(reinterpret_cast<const std::byte *>(&val), sizeof(val));
+					else
 					{
-						write(val.*D::pointer);
-					});
+						member_run<const std::byte> run;
+						mp11::mp_for_each<described_members_t<T>>([&]<typename D>(D)
+						{
+							write_member(val.*D::pointer, run);
+						});
+						flush(run);
+					}
 				}
 				else if constexpr (sr::common_range<T>)
 				{
 					write_range(val);
 				}
+				else if constexpr (varint_encoded<T, State>)
+					write_varint(val);
 				else if constexpr (std::is_trivially_copyable_v<T>)
 					add(reinterpret_cast<const std::byte *>(&val), sizeof(val));
 				else
 				{
 					// use cista reflection
-					write(cista::to_tuple(val));
+					std::apply([&](const auto &...members)
+						{
+							write_members(members...);
+						}, cista::to_tuple(val));
 				}
 			}
 
 		public:
 			struct is_serializer_writer;
 
-			Writer() requires (!state_holder::has_state) = default;
-			Writer(std::vector<std::byte> &&storage) noexcept requires (!state_holder::has_state) :
+			Writer() requires (!holder_t::has_state) = default;
+			Writer(payload_t &&storage) noexcept requires (!holder_t::has_state) :
 				storage{ std::move(storage) }
 			{}
 
-			Writer(State &state) noexcept requires state_holder::has_state : 
-				state_holder{ state }
+			Writer(State &state) noexcept requires holder_t::has_state : 
+				holder_t{ state }
 			{}
 
-			Writer(std::vector<std::byte> &&storage, State &state) noexcept requires state_holder::has_state :
-				storage{ std::move(storage) },
-				state_holder{ state }
+			Writer(payload_t &&storage, State &state) noexcept requires holder_t::has_state :
+				holder_t{ state },
+				storage{ std::move(storage) }
 			{}
 
 
@@ -256,6 +675,28 @@ namespace crpc
 				return std::move(storage);
 			}
 
+			// Bytes written so far
+			size_t size() const noexcept
+			{
+				if constexpr (SizeOnly)
+					return counted;
+				else
+					return storage.size();
+			}
+
+			// Makes room for `size` more bytes
+			void reserve(size_t size)
+			{
+				storage.reserve(storage.size() + size);
+			}
+
+			// Whether `serialized_size` of `Args` is cheap enough to be computed before writing them, see `is_cheap_to_size`
+			template<class...Args>
+			static consteval bool sized_up_front() noexcept
+			{
+				return (is_cheap_to_size(std::type_identity<std::remove_cvref_t<Args>>{}) && ...);
+			}
+
 			template<class T>
 			Writer &operator <<(const T &val)
 			{
@@ -263,23 +704,48 @@ namespace crpc
 				return *this;
 			}
 
-			State &state() const noexcept requires state_holder::has_state
+			State &state() const noexcept requires holder_t::has_state
 			{
-				return state_holder::state;
+				return holder_t::state;
 			}
 		};
 
 		// deduction guides
 		Writer()->Writer<>;
-		Writer(std::vector<std::byte> &&storage)->Writer<>;
+		Writer(payload_t &&storage)->Writer<>;
 
 		template<class State>
 		Writer(State &state)->Writer<State>;
 
+		// Exact number of bytes `create_writer` produces for `args`, computed without writing them
+		template<class...Args>
+		inline size_t serialized_size(const Args &...args)
+		{
+			Writer<empty_serializer_state, true> w;
+			(w << ... << args);
+			return w.size();
+		}
+
+		template<class State, class...Args>
+		inline size_t serialized_size_with_state(State &state, const Args &...args)
+		{
+			if constexpr (std::same_as<State, empty_serializer_state>)
+				return serialized_size(args...);
+			else
+			{
+				Writer<State, true> w{ state };
+				(w << ... << args);
+				return w.size();
+			}
+		}
+
+		// The payload is reserved up front only when its size is cheap to compute, otherwise it grows as it is written
 		template<class...Args>
 		inline auto create_writer(const Args &...args)
 		{
 			Writer w;
+			if constexpr (Writer<>::sized_up_front<Args...>())
+				w.reserve(serialized_size(args...));
 			(w << ... << args);
 			return w;
 		}
@@ -288,39 +754,37 @@ namespace crpc
 		inline auto create_writer_with_state(State &state, const Args &...args)
 		{
 			if constexpr (std::same_as<State, empty_serializer_state>)
-			{
-				Writer w;
-				(w << ... << args);
-				return w;
-			}
+				return create_writer(args...);
 			else
 			{
 				Writer w{ state };
+				if constexpr (Writer<State>::template sized_up_front<Args...>())
+					w.reserve(serialized_size_with_state(state, args...));
 				(w << ... << args);
 				return w;
 			}
 		}
 
 		template<class...Args>
-		inline auto create_writer_on(std::vector<std::byte> &&data, const Args &...args)
+		inline auto create_writer_on(payload_t &&data, const Args &...args)
 		{
 			Writer w{ std::move(data) };
+			if constexpr (Writer<>::sized_up_front<Args...>())
+				w.reserve(serialized_size(args...));
 			(w << ... << args);
 			return w;
 		}
 
 		template<class State, class...Args>
-		inline Writer<> create_writer_on_with_state(std::vector<std::byte> &&data, State &state, const Args &...args)
+		inline auto create_writer_on_with_state(payload_t &&data, State &state, const Args &...args)
 		{
 			if constexpr (std::same_as<State, empty_serializer_state>)
-			{
-				Writer w{ std::move(data) };
-				(w << ... << args);
-				return w;
-			}
+				return create_writer_on(std::move(data), args...);
 			else
 			{
 				Writer w{ std::move(data), state };
+				if constexpr (Writer<State>::template sized_up_front<Args...>())
+					w.reserve(serialized_size_with_state(state, args...));
 				(w << ... << args);
 				return w;
 			}
@@ -333,16 +797,24 @@ namespace crpc
 			c.resize(newsize);
 		};
 
-		template<class T, class Reader>
-		concept supports_custom_read_internal = requires(T & v, Reader & r)
+		// A std::span<const T> or std::basic_string_view read from a payload. The view points into the payload
+		// when the elements are stored there as-is and suitably aligned, and into its own copy otherwise, so the payload must outlive it.
+		template<class View>
+		class borrowed_view
 		{
-			v.serialize_read(r);
-		};
+			template<class State>
+			friend class Reader;
 
-		template<class T, class Reader>
-		concept supports_custom_read_external = requires(T & v, Reader & r)
-		{
-			serialize_read(r, v);
+			using element_type = std::remove_cv_t<typename View::value_type>;
+
+			View view;
+			std::vector<element_type> storage;
+
+		public:
+			operator View() const noexcept
+			{
+				return view;
+			}
 		};
 
 		template<class State = empty_serializer_state>
@@ -350,7 +822,7 @@ namespace crpc
 		{
 			using span = std::span<const std::byte>;
 			using iterator = typename span::iterator;
-			using state_holder = state_holder<State>;
+			using holder_t = state_holder<State>;
 
 			span range;
 			iterator it;
@@ -361,12 +833,103 @@ namespace crpc
 				it += size;
 			}
 
+			template<class T>
+			T read_varint() noexcept
+			{
+				uint64_t value{};
+				size_t size{};
+				if (range.end() - it >= 8)
+					size = decode_varint8(std::to_address(it), value);
+				if (!size)
+					size = decode_varint(std::to_address(it), value);
+				it += size;
+				return from_varint<T>(value);
+			}
+
+			// Whenever the next 8 bytes are all single-byte values, they are decoded together
+			template<class T>
+			void read_varints(T *destination, size_t count) noexcept
+			{
+				while (count)
+				{
+					if constexpr (std::endian::native == std::endian::little)
+					{
+						if (count >= 8 && range.end() - it >= 8)
+						{
+							uint64_t word;
+							std::memcpy(&word, std::to_address(it), sizeof(word));
+							if (!(word & varint_continuation_bits))
+							{
+								for (size_t i = 0; i < 8; ++i)
+									destination[i] = from_varint<T>((word >> (i * 8)) & 0xff);
+								destination += 8;
+								count -= 8;
+								it += 8;
+								continue;
+							}
+						}
+					}
+					*destination++ = read_varint<T>();
+					--count;
+				}
+			}
+
+			template<class T>
+			static constexpr bool is_bulk() noexcept
+			{
+				if constexpr (is_compact<State>())
+					return is_bitwise<T, Reader>();
+				else
+					return std::is_trivially_copyable_v<T>;
+			}
+
+			template<class T>
+			void skip_padding() noexcept
+			{
+				it += array_padding<State, T>(static_cast<size_t>(it - range.begin()));
+			}
+
+			void flush(member_run<std::byte> &run)
+			{
+				if (run.size)
+					read(run.begin, run.size);
+				run = {};
+			}
+
+			template<class T>
+			void read_member(T &member, member_run<std::byte> &run)
+			{
+				if constexpr (is_bitwise<T, Reader>())
+				{
+					if (is_dense(member))
+					{
+						if (!run.extend(member))
+						{
+							flush(run);
+							run.extend(member);
+						}
+						return;
+					}
+				}
+				flush(run);
+				read(member);
+			}
+
+			template<class...Members>
+			void read_members(Members &...members)
+			{
+				member_run<std::byte> run;
+				(..., read_member(members, run));
+				flush(run);
+			}
+
 			template<class Iterator, class Sentinel>
 			void read(const Iterator &begin, const Sentinel &end, std::true_type)
 			{
 				const auto size = sizeof(*begin) * std::distance(begin, end);
 				if (size)
 				{
+					skip_padding<std::iter_value_t<Iterator>>();
 					std::copy(it, it + size, reinterpret_cast<std::byte *>(std::addressof(*begin)));
 					it += size;
 				}
@@ -385,16 +948,51 @@ namespace crpc
 			{
 				uint32_t count;
 				read(count);
-				val.resize_and_overwrite(count, [&](Char *data, size_t size)
+				if (count)
+					skip_padding<Char>();
+				// the operation may be given more room than `count`; it only fills and keeps `count` characters
+				val.resize_and_overwrite(count, [&](Char *data, size_t)
 					{
-						read(reinterpret_cast<std::byte *>(data), sizeof(Char) * size);
-						return size;
+						read(reinterpret_cast<std::byte *>(data), sizeof(Char) * count);
+						return static_cast<size_t>(count);
 					});
 			}
 
 			// serialization of std::error_code is prohibited because it is not portable
 			void read(std::error_code &) = delete;
 
+			// same format as a vector or string of the elements
+			template<class View>
+			void read(borrowed_view<View> &val)
+			{
+				using T = typename borrowed_view<View>::element_type;
+				uint32_t count;
+				read(count);
+				// elements the format does not store byte for byte are decoded into the view's own storage
+				if constexpr (!is_bulk<T>())
+				{
+					read_range(val.storage, count, std::false_type{});
+					val.view = View{ val.storage.data(), count };
+				}
+				else
+				{
+					if (count)
+						skip_padding<T>();
+					const auto *begin = std::to_address(it);
+					if (reinterpret_cast<uintptr_t>(begin) % alignof(T) == 0)
+					{
+						val.view = View{ reinterpret_cast<const T *>(begin), count };
+						it += sizeof(T) * count;
+					}
+					else
+					{
+						val.storage.resize(count);
+						read(reinterpret_cast<std::byte *>(val.storage.data()), sizeof(T) * count);
+						val.view = View{ val.storage.data(), count };
+					}
+				}
+			}
+
 			// vector
 			template<class T>
 			void read(std::vector<T> &val)
@@ -486,22 +1084,33 @@ namespace crpc
 				}
 				else if constexpr (boost::describe::has_describe_members<T>::value)
 				{
-					mp11::mp_for_each<boost::describe::describe_members<T, boost::describe::mod_any_access>>([&]<typename D>(D)
+					if (is_bitwise<T, Reader>() && is_dense(val))
+						read(reinterpret_cast<std::byte *>(&val), sizeof(val));
+					else
 					{
-						read(val.*D::pointer);
-					});
+						member_run<std::byte> run;
+						mp11::mp_for_each<described_members_t<T>>([&]<typename D>(D)
+						{
+							read_member(val.*D::pointer, run);
+						});
+						flush(run);
+					}
 				}
 				else if constexpr (sr::common_range<T>)
 				{
 					read_range(val);
 				}
+				else if constexpr (varint_encoded<T, State>)
+					val = read_varint<T>();
 				else if constexpr (std::is_trivially_copyable_v<T>)
 					read(reinterpret_cast<std::byte *>(&val), sizeof(val));
 				else
 				{
 					// use cista reflection
-					auto tuple = cista::to_tuple(val);
-					read(tuple);
+					std::apply([&](auto &...members)
+						{
+							read_members(members...);
+						}, cista::to_tuple(val));
 				}
 			}
 
@@ -511,7 +1120,7 @@ namespace crpc
 				using value_type = sr::range_value_t<T>;
 				uint32_t count;
 				read(count);
-				read_range(val, count, std::is_trivially_copyable<value_type>{});
+				read_range(val, count, std::bool_constant<is_bulk<value_type>()>{});
 			}
 
 			template<class T>
@@ -526,37 +1135,45 @@ namespace crpc
 			void read_range(T &val, size_t count, std::false_type)
 			{
 				using value_type = safe_value_type_t<sr::range_value_t<T>>;
-				val.clear();
-				if constexpr (has_reserve<T>)
-					val.reserve(count);
-				while (count--)
+				if constexpr (varint_encoded<value_type, State> && sr::contiguous_range<T> && container_has_resize<T>)
 				{
-					value_type v;
-					read(v);
-					if constexpr (has_emplace_back<T>)
-						val.emplace_back(std::move(v));
-					else
-						val.insert(std::move(v));
+					val.resize(count);
+					read_varints(sr::data(val), count);
+				}
+				else
+				{
+					val.clear();
+					if constexpr (has_reserve<T>)
+						val.reserve(count);
+					while (count--)
+					{
+						value_type v;
+						read(v);
+						if constexpr (has_emplace_back<T>)
+							val.emplace_back(std::move(v));
+						else
+							val.insert(std::move(v));
+					}
 				}
 			}
 
 		public:
 			struct is_serializer_reader;
 
-			Reader(span range) noexcept requires (!state_holder::has_state) :
+			Reader(span range) noexcept requires (!holder_t::has_state) :
 				range{ range },
 				it{ sr::begin(range) }
 			{
 			}
 
-			Reader(span range, empty_serializer_state &) noexcept requires (!state_holder::has_state) :
+			Reader(span range, empty_serializer_state &) noexcept requires (!holder_t::has_state) :
 				range{ range },
 				it{ sr::begin(range) }
 			{
 			}
 
-			Reader(span range, State &state) noexcept requires state_holder::has_state :
-				state_holder{ state },
+			Reader(span range, State &state) noexcept requires holder_t::has_state :
+				holder_t{ state },
 				range{ range },
 				it{ sr::begin(range) }
 			{
@@ -579,9 +1196,9 @@ namespace crpc
 				return std::span{ it, range.end() };
 			}
 
-			State &state() const noexcept requires state_holder::has_state
+			State &state() const noexcept requires holder_t::has_state
 			{
-				return state_holder::state;
+				return holder_t::state;
 			}
 
 			void read_bytes(std::span<std::byte> destination)
@@ -626,6 +1243,8 @@ namespace crpc
 	using details::create_writer_with_state;
 	using details::create_writer_on;
 	using details::create_writer_on_with_state;
+	using details::serialized_size;
+	using details::serialized_size_with_state;
 
 	using details::concepts::reader;
 	using details::concepts::writer;
@@ -12,6 +12,8 @@
 #include <corsl/cancel.h>
 #include <winrt/base.h>
 
+#include <span>
+
 namespace crpc::sockets
 {
 	struct ITcpSocket
@@ -20,7 +22,11 @@ namespace crpc::sockets
 		virtual corsl::future<void> connect(std::wstring host, int port) = 0;
 
 		virtual corsl::future<uint32_t> send(winrt::array_view<const uint8_t> data) = 0;
+		// sends all buffers in order, without interleaving other sends
+		virtual corsl::future<uint32_t> send(std::span<const winrt::array_view<const uint8_t>> buffers) = 0;
 		virtual corsl::future<std::vector<uint8_t>> receive(const corsl::cancellation_source &csource) = 0;
+		// receives up to target.size() bytes straight into target, returns the number of bytes received or 0 if the connection is closed
+		virtual corsl::future<uint32_t> receive(winrt::array_view<uint8_t> target, const corsl::cancellation_source &csource) = 0;
 
 		virtual void close() = 0;
 	};
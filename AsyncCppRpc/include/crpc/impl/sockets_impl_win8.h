@@ -19,6 +19,8 @@
 #include <winrt/Windows.Web.Http.Headers.h>
 #include <winrt/Windows.Storage.Streams.h>
 
+#include <robuffer.h>
+
 #pragma comment(lib, "windowsapp")
 
 namespace crpc::sockets::win8
@@ -26,6 +28,8 @@ namespace crpc::sockets::win8
 	namespace impl
 	{
 		constexpr const uint32_t max_read_buffer_size = 65536;
+		// parts of a send smaller than this are gathered into one write, larger ones are written from the caller's memory
+		constexpr const uint32_t gather_threshold = 4096;
 
 		namespace net = winrt::Windows::Networking;
 		namespace streams = winrt::Windows::Storage::Streams;
@@ -43,11 +47,47 @@ namespace crpc::sockets::win8
 			return result;
 		}
 
+		// A buffer over memory owned by the caller, lets the stream read straight into it
+		struct view_buffer : winrt::implements<view_buffer, streams::IBuffer, ::Windows::Storage::Streams::IBufferByteAccess>
+		{
+			winrt::array_view<uint8_t> view;
+			uint32_t length{};
+
+			explicit view_buffer(winrt::array_view<uint8_t> view) noexcept :
+				view{ view }
+			{}
+
+			uint32_t Capacity() const noexcept
+			{
+				return view.size();
+			}
+
+			uint32_t Length() const noexcept
+			{
+				return length;
+			}
+
+			void Length(uint32_t value)
+			{
+				if (value > view.size())
+					throw winrt::hresult_invalid_argument{};
+				length = value;
+			}
+
+			HRESULT __stdcall Buffer(uint8_t **value) noexcept final
+			{
+				*value = view.data();
+				return S_OK;
+			}
+		};
+
 		class TcpSocket : public ITcpSocket
 		{
 			winrt::Windows::Networking::Sockets::StreamSocket socket;
 			streams::IOutputStream output_stream{ socket.OutputStream() };
 			streams::IInputStream input_stream{ socket.InputStream() };
+			// staging buffer for gathered sends, kept between calls. Sends on a socket are not concurrent
+			std::vector<uint8_t> gathered;
 
 		public:
 			TcpSocket()
@@ -80,11 +120,51 @@ namespace crpc::sockets::win8
 				socket.Close();
 			}
 
+			corsl::future<uint32_t> write_in_place(winrt::array_view<const uint8_t> data)
+			{
+				// the stream only reads from the buffer
+				auto *first = const_cast<uint8_t *>(data.data());
+				auto buffer = winrt::make<view_buffer>(winrt::array_view<uint8_t>{ first, first + data.size() });
+				buffer.Length(data.size());
+				co_return co_await output_stream.WriteAsync(buffer);
+			}
+
 			virtual corsl::future<uint32_t> send(winrt::array_view<const uint8_t> data) override
 			{
 				try
 				{
-					co_return co_await output_stream.WriteAsync(winrt::Windows::Security::Cryptography::CryptographicBuffer::CreateFromByteArray(data));
+					co_return co_await write_in_place(data);
+				}
+				catch (const winrt::hresult_error &er)
+				{
+					corsl::throw_error(er.code());
+				}
+			}
+
+			virtual corsl::future<uint32_t> send(std::span<const winrt::array_view<const uint8_t>> buffers) override
+			{
+				try
+				{
+					// the stream takes a single buffer per write: small parts are copied together, large ones are written back-to-back in place
+					uint32_t written{};
+					gathered.clear();
+					for (const auto &data : buffers)
+					{
+						if (data.size() < gather_threshold)
+						{
+							gathered.insert(gathered.end(), data.begin(), data.end());
+							continue;
+						}
+						if (!gathered.empty())
+						{
+							written += co_await write_in_place(gathered);
+							gathered.clear();
+						}
+						written += co_await write_in_place(data);
+					}
+					if (!gathered.empty())
+						written += co_await write_in_place(gathered);
+					co_return written;
 				}
 				catch (const winrt::hresult_error &er)
 				{
@@ -115,6 +195,32 @@ namespace crpc::sockets::win8
 					corsl::throw_error(er.code());
 				}
 			}
+
+			virtual corsl::future<uint32_t> receive(winrt::array_view<uint8_t> target, const corsl::cancellation_source &csource) override
+			{
+				corsl::cancellation_token token{ co_await csource };
+				try
+				{
+					auto buffer = winrt::make<view_buffer>(target);
+					auto read_op = input_stream.ReadAsync(buffer, target.size(), streams::InputStreamOptions::Partial);
+					corsl::cancellation_subscription sub{ token,[&]
+					{
+						read_op.Cancel();
+					} };
+
+					auto result = co_await read_op;
+
+					// the stream may return data in a buffer of its own instead of the one it was given
+					const auto length = result.Length();
+					if (result.data() != target.data())
+						memcpy(target.data(), result.data(), length);
+					co_return length;
+				}
+				catch (const winrt::hresult_error &er)
+				{
+					corsl::throw_error(er.code());
+				}
+			}
 		};
 
 		class TcpSocketListener : public ITcpSocketListener
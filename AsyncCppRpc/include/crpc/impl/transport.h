@@ -42,6 +42,56 @@ namespace crpc
 			}
 		};
 
+		// Type-erased reference to an executor, any type with `post(std::coroutine_handle<>)`
+		class executor_ref
+		{
+			void *target{};
+			void (*post_fn)(void *, std::coroutine_handle<>) {};
+
+		public:
+			executor_ref() = default;
+
+			template<class E>
+				requires (!std::same_as<std::remove_cv_t<E>, executor_ref>)
+			executor_ref(E &executor) noexcept :
+				target{ &executor },
+				post_fn{ [](void *target, std::coroutine_handle<> h) { static_cast<E *>(target)->post(h); } }
+			{}
+
+			void post(std::coroutine_handle<> h) const
+			{
+				post_fn(target, h);
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return target != nullptr;
+			}
+		};
+
+		inline auto resume_on(executor_ref executor) noexcept
+		{
+			struct awaiter
+			{
+				executor_ref executor;
+
+				bool await_ready() const noexcept
+				{
+					return false;
+				}
+
+				void await_suspend(std::coroutine_handle<> h) const
+				{
+					executor.post(h);
+				}
+
+				void await_resume() const noexcept
+				{}
+			};
+
+			return awaiter{ executor };
+		}
+
 		namespace concepts
 		{
 			template<class T>
@@ -54,14 +104,42 @@ namespace crpc
 				{ v.read() } -> std::same_as<corsl::future<message_t>>;
 				{ v.write(message) } -> std::same_as<corsl::future<>>;
 			};
+
+			// A transport that can send several messages with a single write. Messages are sent in order and may be moved from.
+			template<class T>
+			concept batch_transport = transport<T> &&
+				requires(T & v, std::span<message_t> messages)
+			{
+				{ v.write_batch(messages) } -> std::same_as<corsl::future<>>;
+			};
+
+			// A transport that can deliver several messages per read. `read_batch` appends at least one message to `messages`,
+			// followed by any further messages that have already been received in full.
+			template<class T>
+			concept batch_read_transport = transport<T> &&
+				requires(T & v, std::vector<message_t> &messages)
+			{
+				{ v.read_batch(messages) } -> std::same_as<corsl::future<>>;
+			};
+
+			// A transport that may be pinned to an executor. The reader and writer of a connection over a pinned transport
+			// run on that executor instead of the background pool. An empty reference means the transport is not pinned.
+			template<class T>
+			concept pinned_transport = transport<T> &&
+				requires(const T & cv)
+			{
+				{ cv.get_executor() } -> std::same_as<executor_ref>;
+			};
 		}
 
-		struct __declspec(novtable) dynamic_transport_base
+		struct CRPC_NOVTABLE dynamic_transport_base
 		{
 			virtual ~dynamic_transport_base() = default;
 			virtual void set_cancellation_token(const corsl::cancellation_source &src) = 0;
 			virtual corsl::future<message_t> read() = 0;	// propagates HRESULT exception on error
+			virtual corsl::future<> read_batch(std::vector<message_t> &messages) = 0;	// propagates HRESULT exception on error
 			virtual corsl::future<> write(message_t message) = 0;	// propagates HRESULT exception on error
+			virtual corsl::future<> write_batch(std::span<message_t> messages) = 0;	// propagates HRESULT exception on error
 		};
 
 		struct dynamic_transport
@@ -83,10 +161,20 @@ namespace crpc
 				return impl->read();
 			}
 
+			corsl::future<> read_batch(std::vector<message_t> &messages)
+			{
+				return impl->read_batch(messages);
+			}
+
 			corsl::future<> write(message_t message)
 			{
 				return impl->write(std::move(message));
 			}
+
+			corsl::future<> write_batch(std::span<message_t> messages)
+			{
+				return impl->write_batch(messages);
+			}
 		};
 
 		template<concepts::transport T>
@@ -112,15 +200,38 @@ namespace crpc
 				return getT()->read();
 			}
 
+			virtual corsl::future<> read_batch(std::vector<message_t> &messages) override
+			{
+				if constexpr (concepts::batch_read_transport<T>)
+					co_return co_await getT()->read_batch(messages);
+				else
+				{
+					auto message = co_await getT()->read();
+					messages.push_back(std::move(message));
+				}
+			}
+
 			virtual corsl::future<> write(message_t message) override
 			{
 				return getT()->write(std::move(message));
 			}
+
+			virtual corsl::future<> write_batch(std::span<message_t> messages) override
+			{
+				if constexpr (concepts::batch_transport<T>)
+					co_return co_await getT()->write_batch(messages);
+				else
+				{
+					for (auto &message : messages)
+						co_await getT()->write(std::move(message));
+				}
+			}
 		public:
 			using T::T;
 		};
 	}
 	using details::concepts::transport;
+	using details::concepts::batch_transport;
 	using details::dynamic_transport;
 	using details::dynamic_transport_impl;
 }
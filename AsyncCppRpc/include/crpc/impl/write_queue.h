@@ -0,0 +1,203 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "transport.h"
+
+#include <thread>
+
+namespace crpc::details
+{
+	// Intrusive multi-producer, single-consumer queue of outgoing messages. Producers link a node with a single exchange,
+	// which never waits. The single consumer takes everything queued so far in one go, spinning briefly before it suspends.
+	class write_queue
+	{
+		struct node
+		{
+			std::atomic<node *> next{};
+			message_t message;
+		};
+
+		static constexpr const unsigned max_spin_count = 256;
+
+		// the consumer owns head, producers exchange tail
+		node stub;
+		node *head{ &stub };
+		std::atomic<node *> tail{ &stub };
+
+		std::coroutine_handle<> waiter;
+		std::atomic<bool> waiting{};
+		executor_ref executor;
+		// a cancellation is delivered to exactly one call to `take`
+		std::atomic<bool> cancelled{};
+		// once closed, `push` drops messages; `close` waits for the producers that got past the check
+		std::atomic<bool> closed{};
+		std::atomic<unsigned> pushing{};
+
+		static unsigned spin_count() noexcept
+		{
+			static const unsigned count = std::thread::hardware_concurrency() > 1 ? max_spin_count : 0;
+			return count;
+		}
+
+		static node *create_node(message_t &&message)
+		{
+			return ::new (payload_pool::allocate(sizeof(node))) node{ nullptr, std::move(message) };
+		}
+
+		static void destroy_node(node *n) noexcept
+		{
+			n->~node();
+			payload_pool::deallocate(n, sizeof(node));
+		}
+
+		static corsl::fire_and_forget resume_background(std::coroutine_handle<> h)
+		{
+			co_await corsl::resume_background();
+			h.resume();
+		}
+
+		void wake()
+		{
+			if (waiting.load() && waiting.exchange(false))
+			{
+				if (executor)
+					executor.post(waiter);
+				else
+					resume_background(waiter);
+			}
+		}
+
+		bool is_ready() const noexcept
+		{
+			return cancelled.load() || head->next.load() != nullptr;
+		}
+
+		// Moves all fully linked messages to `batch`
+		void drain(std::vector<message_t> &batch)
+		{
+			while (auto *next = head->next.load(std::memory_order_acquire))
+			{
+				batch.push_back(std::move(next->message));
+				if (head != &stub)
+					destroy_node(head);
+				head = next;
+			}
+		}
+
+	public:
+		write_queue() = default;
+		write_queue(const write_queue &) = delete;
+		write_queue &operator =(const write_queue &) = delete;
+
+		~write_queue()
+		{
+			reset();
+		}
+
+		// Stops accepting messages and waits until no producer is linking a node, so that `reset` may follow
+		void close() noexcept
+		{
+			closed.store(true);
+			while (pushing.load())
+				std::this_thread::yield();
+		}
+
+		// Drops all queued messages and a pending cancellation and opens the queue again.
+		// Must be called after `close`, or while no producer may be active, and never while the consumer is active.
+		void reset() noexcept
+		{
+			while (auto *next = head->next.load(std::memory_order_acquire))
+			{
+				if (head != &stub)
+					destroy_node(head);
+				head = next;
+			}
+			if (head != &stub)
+				destroy_node(head);
+			stub.next.store(nullptr);
+			head = &stub;
+			tail.store(&stub);
+			waiting.store(false);
+			cancelled.store(false);
+			closed.store(false);
+		}
+
+		// The consumer is resumed on `executor_` instead of the background pool. Must be called before the first `take`.
+		void set_executor(executor_ref executor_) noexcept
+		{
+			executor = executor_;
+		}
+
+		// Returns false, dropping the message, if the queue is closed
+		bool push(message_t message)
+		{
+			// pairs with `close`: either the producer sees the flag or `close` sees the producer
+			pushing.fetch_add(1);
+			if (closed.load())
+			{
+				pushing.fetch_sub(1);
+				return false;
+			}
+			auto *n = create_node(std::move(message));
+			tail.exchange(n, std::memory_order_acq_rel)->next.store(n);
+			wake();
+			pushing.fetch_sub(1);
+			return true;
+		}
+
+		void cancel()
+		{
+			cancelled.store(true);
+			wake();
+		}
+
+		// Waits until at least one message is queued and moves all queued messages to `batch`
+		auto take(std::vector<message_t> &batch)
+		{
+			struct awaiter
+			{
+				write_queue &queue;
+				std::vector<message_t> &batch;
+
+				bool await_ready() const noexcept
+				{
+					for (auto count = spin_count(); !queue.is_ready(); --count)
+					{
+						if (!count)
+							return false;
+					}
+					return true;
+				}
+
+				bool await_suspend(std::coroutine_handle<> h)
+				{
+					// once the flag is set, a producer may resume the consumer at any moment,
+					// so neither head nor this awaiter may be touched afterwards
+					auto &q = queue;
+					const auto *last = q.head;
+					q.waiter = h;
+					q.waiting.store(true);
+					// a producer that has not seen the flag has already swapped the tail
+					return !((q.tail.load() != last || q.cancelled.load()) && q.waiting.exchange(false));
+				}
+
+				void await_resume()
+				{
+					if (queue.cancelled.exchange(false))
+						throw corsl::operation_cancelled{};
+					queue.drain(batch);
+				}
+			};
+
+			assert(batch.empty());
+			return awaiter{ *this, batch };
+		}
+	};
+}
@@ -0,0 +1,127 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "impl/transport.h"
+
+namespace crpc
+{
+	namespace details::loopback
+	{
+		// HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE)
+		inline constexpr const HRESULT error_disconnected = static_cast<HRESULT>(0x8007006D);
+
+		// An empty message tells the reader the other end is gone
+		struct loopback_channel
+		{
+			corsl::async_queue<std::optional<message_t>> queues[2];
+			std::atomic<bool> closed{};
+		};
+
+		// One end of an in-process transport pair. Messages are moved through a queue, no bytes are copied.
+		class loopback_transport
+		{
+			std::shared_ptr<loopback_channel> channel;
+			unsigned side{};
+			corsl::cancellation_source cancel;
+
+			auto &inbound() noexcept
+			{
+				return channel->queues[side];
+			}
+
+			auto &outbound() noexcept
+			{
+				return channel->queues[side ^ 1];
+			}
+
+			void close() noexcept
+			{
+				if (channel && !channel->closed.exchange(true, std::memory_order_relaxed))
+					outbound().push(std::nullopt);
+				channel.reset();
+			}
+
+		public:
+			loopback_transport() = default;
+			loopback_transport(std::shared_ptr<loopback_channel> channel, unsigned side) noexcept :
+				channel{ std::move(channel) },
+				side{ side }
+			{}
+
+			loopback_transport(loopback_transport &&) = default;
+
+			loopback_transport &operator =(loopback_transport &&o) noexcept
+			{
+				if (this != &o)
+				{
+					close();
+					channel = std::move(o.channel);
+					side = o.side;
+					cancel = std::move(o.cancel);
+				}
+				return *this;
+			}
+
+			~loopback_transport()
+			{
+				close();
+			}
+
+			void set_cancellation_token(const corsl::cancellation_source &src)
+			{
+				cancel = src.create_connected_source();
+			}
+
+			corsl::future<message_t> read()
+			{
+				if (!channel)
+					corsl::throw_error(E_FAIL);
+
+				corsl::cancellation_token token{ co_await cancel };
+				corsl::cancellation_subscription subscription{ token, [this]
+					{
+						inbound().cancel();
+					} };
+
+				auto message = co_await inbound().next();
+				if (!message)
+					corsl::throw_error(error_disconnected);
+				co_return std::move(*message);
+			}
+
+			corsl::future<> write(message_t message)
+			{
+				if (!channel)
+					corsl::throw_error(E_FAIL);
+				if (channel->closed.load(std::memory_order_relaxed))
+					corsl::throw_error(error_disconnected);
+
+				outbound().push(std::move(message));
+				co_return;
+			}
+		};
+
+		// Creates two connected transports
+		inline std::pair<loopback_transport, loopback_transport> create_pair()
+		{
+			auto channel = std::make_shared<loopback_channel>();
+			return { loopback_transport{ channel, 0 }, loopback_transport{ channel, 1 } };
+		}
+
+		static_assert(concepts::transport<loopback_transport>);
+	}
+
+	namespace transports::loopback
+	{
+		using details::loopback::loopback_transport;
+		using details::loopback::create_pair;
+		using details::loopback::error_disconnected;
+	}
+}
@@ -21,6 +21,8 @@ namespace crpc
 		};
 
 		constexpr const size_t MaxSupportedRead = 65536;
+		// a message smaller than this is copied together with its header and sent with a single write
+		constexpr const size_t gather_threshold = 4096;
 
 		inline auto prepare_handle(const winrt::file_handle &pipe) noexcept
 		{
@@ -122,10 +124,22 @@ namespace crpc
 				pipe_message_header pmh{ message };
 				pmh.payload_size = static_cast<uint32_t>(message.payload.size());
 
-				co_await write(as_bytes(std::span{ &pmh, 1 }));
-
 				auto *data = message.payload.data();
 				auto size = message.payload.size();
+
+				// pipes have no gather write: small messages are staged with their header, larger ones are written after it in place
+				if (sizeof(pmh) + size < gather_threshold)
+				{
+					payload_t buffer(sizeof(pmh) + size);
+					memcpy(buffer.data(), &pmh, sizeof(pmh));
+					if (size)
+						memcpy(buffer.data() + sizeof(pmh), data, size);
+					co_await write(buffer);
+					co_return;
+				}
+
+				co_await write(as_bytes(std::span{ &pmh, 1 }));
+
 				while (size)
 				{
 					auto towrite = std::min(size, MaxSupportedRead);
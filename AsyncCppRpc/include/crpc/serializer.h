@@ -8,3 +8,10 @@
 
 #pragma once
 #include "impl/serializer.h"
+
+namespace crpc
+{
+	// serializer state options, see with_serializer_state
+	using details::aligned_framing;
+	using details::compact_encoding;
+}
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#if !defined(_WIN32)
+#include "impl/posix/tcp_transport.h"
+#else
 #include "impl/transport.h"
 #include "impl/sockets_impl_win8.h"
 
@@ -26,11 +29,53 @@ namespace crpc
 			uint32_t payload_size;
 		};
 
+		// After a payload of at least this size the next frame is assumed to be large too and is received without the buffer
+		constexpr const size_t direct_receive_threshold = 16 * 1024;
+
 		class tcp_transport
 		{
 			corsl::cancellation_source cancel;
 			std::unique_ptr<sockets::ITcpSocket> socket;
 			std::vector<uint8_t> receive_buffer;
+			size_t receive_begin{};
+			bool expect_large{};
+
+			size_t buffered() const noexcept
+			{
+				return receive_buffer.size() - receive_begin;
+			}
+
+			// Moves a message that has been received in full out of the receive buffer
+			corsl::future<> receive_exactly(uint8_t *data, size_t size)
+			{
+				for (size_t received = 0; received < size;)
+				{
+					const winrt::array_view<uint8_t> target{ data + received, data + size };
+					const auto count = co_await socket->receive(target, cancel);
+					if (!count)
+						corsl::throw_win32_error(WSAECONNRESET);
+					received += count;
+				}
+			}
+
+			bool take_buffered(std::vector<message_t> &messages)
+			{
+				if (buffered() < sizeof(tcp_message_header))
+					return false;
+
+				tcp_message_header header;
+				memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				if (buffered() - sizeof(header) < header.payload_size)
+					return false;
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				memcpy(payload.data(), receive_buffer.data() + receive_begin, payload.size());
+				receive_begin += payload.size();
+				expect_large = payload.size() >= direct_receive_threshold;
+				messages.emplace_back(header, std::move(payload));
+				return true;
+			}
 
 		public:
 			void set_cancellation_token(const corsl::cancellation_source &src)
@@ -43,33 +88,93 @@ namespace crpc
 				auto data = co_await socket->receive(cancel);
 				if (data.empty())
 					corsl::throw_win32_error(WSAECONNRESET);
-				receive_buffer.insert(receive_buffer.end(), data.begin(), data.end());
+
+				if (!buffered())
+				{
+					// nothing is left over, take the received chunk as is
+					receive_buffer = std::move(data);
+					receive_begin = 0;
+				}
+				else
+				{
+					// compact only when the consumed part outweighs the rest, so each byte is moved at most once on average
+					if (receive_begin >= buffered())
+					{
+						receive_buffer.erase(receive_buffer.begin(), receive_buffer.begin() + receive_begin);
+						receive_begin = 0;
+					}
+					receive_buffer.insert(receive_buffer.end(), data.begin(), data.end());
+				}
 			}
 
 			corsl::future<message_t> read()
 			{
-				while (receive_buffer.size() < sizeof(tcp_message_header))
-					co_await read_next();
-				auto *m = reinterpret_cast<tcp_message_header *>(receive_buffer.data());
-				const auto full_size = sizeof(tcp_message_header) + m->payload_size;
-				while (receive_buffer.size() < full_size)
+				tcp_message_header header;
+				if (expect_large && !buffered())
+				{
+					// the previous payload was large, receive the header alone and the payload straight into place
+					co_await receive_exactly(reinterpret_cast<uint8_t *>(&header), sizeof(header));
+					payload_t payload(header.payload_size);
+					co_await receive_exactly(reinterpret_cast<uint8_t *>(payload.data()), payload.size());
+					expect_large = payload.size() >= direct_receive_threshold;
+					co_return message_t{ header, std::move(payload) };
+				}
+
+				while (buffered() < sizeof(tcp_message_header))
 					co_await read_next();
 
-				m = reinterpret_cast<tcp_message_header *>(receive_buffer.data());
+				memcpy(&header, receive_buffer.data() + receive_begin, sizeof(header));
+				receive_begin += sizeof(header);
+
+				payload_t payload(header.payload_size);
+				auto received = std::min(buffered(), payload.size());
+				memcpy(payload.data(), receive_buffer.data() + receive_begin, received);
+				receive_begin += received;
+
+				// the rest of a large payload is received directly into the payload
+				co_await receive_exactly(reinterpret_cast<uint8_t *>(payload.data()) + received, payload.size() - received);
+				expect_large = payload.size() >= direct_receive_threshold;
+				co_return message_t{ header, std::move(payload) };
+			}
 
-				// TODO: implement payload_t cache allocation
-				const auto *data = reinterpret_cast<const std::byte *>(m + 1);
-				message_t result{ *m, {data, data + m->payload_size } };
-				receive_buffer.erase(receive_buffer.begin(), receive_buffer.begin() + full_size);
-				co_return std::move(result);
+			corsl::future<> read_batch(std::vector<message_t> &messages)
+			{
+				if (!take_buffered(messages))
+				{
+					auto message = co_await read();
+					messages.push_back(std::move(message));
+				}
+				while (take_buffered(messages))
+				{
+				}
 			}
 
 			corsl::future<> write(message_t message)
 			{
 				tcp_message_header header{ message, static_cast<uint32_t>(message.payload.size()) };
-				co_await socket->send({ reinterpret_cast<const uint8_t *>(&header), sizeof(header) });
 				const auto *data = reinterpret_cast<const uint8_t *>(message.payload.data());
-				co_await socket->send({ data, data + message.payload.size() });
+				const winrt::array_view<const uint8_t> buffers[]
+				{
+					{ reinterpret_cast<const uint8_t *>(&header), sizeof(header) },
+					{ data, data + message.payload.size() },
+				};
+				co_await socket->send(buffers);
+			}
+
+			corsl::future<> write_batch(std::span<message_t> messages)
+			{
+				std::vector<tcp_message_header> headers;
+				std::vector<winrt::array_view<const uint8_t>> buffers;
+				headers.reserve(messages.size());
+				buffers.reserve(messages.size() * 2);
+				for (const auto &message : messages)
+				{
+					const auto &header = headers.emplace_back(tcp_message_header{ message, static_cast<uint32_t>(message.payload.size()) });
+					const auto *data = reinterpret_cast<const uint8_t *>(message.payload.data());
+					buffers.emplace_back(reinterpret_cast<const uint8_t *>(&header), static_cast<uint32_t>(sizeof(header)));
+					buffers.emplace_back(data, data + message.payload.size());
+				}
+				co_await socket->send(buffers);
 			}
 
 			corsl::future<> connect(const tcp_config &config)
@@ -123,7 +228,8 @@ namespace crpc
 			}
 		};
 
-		static_assert(concepts::transport<tcp_transport>);
+		static_assert(concepts::batch_transport<tcp_transport>);
+		static_assert(concepts::batch_read_transport<tcp_transport>);
 	}
 
 	namespace transports::tcp
@@ -133,3 +239,4 @@ namespace crpc
 		using details::tcp::tcp_listener;
 	}
 }
+#endif
@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<long> allocations;
+}
+
+// g++ warns about free() on memory from operator new when the replacement operator delete is inlined into its caller
+#if defined(__GNUC__)
+#define CRPC_TEST_NOINLINE [[gnu::noinline]]
+#else
+#define CRPC_TEST_NOINLINE
+#endif
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc{};
+}
+
+CRPC_TEST_NOINLINE void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+CRPC_TEST_NOINLINE void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+struct AllocationCalc
+{
+	crpc::method<corsl::future<int>(int a, int b)> sum;
+};
+
+BOOST_DESCRIBE_STRUCT(AllocationCalc, (), (sum));
+
+namespace
+{
+	using transport_t = crpc::transports::loopback::loopback_transport;
+
+	corsl::future<long> steady_state_allocations(crpc::connection<transport_t, crpc::client_of<AllocationCalc>> &client, int calls)
+	{
+		// warm up the payload pool, the completion table and the per-thread caches
+		for (int i = 0; i < calls; ++i)
+			co_await client.sum(i, 1);
+
+		const auto before = allocations.load();
+		for (int i = 0; i < calls; ++i)
+			co_await client.sum(i, 1);
+		co_return allocations.load() - before;
+	}
+}
+
+// Steady-state calls reuse pooled payloads, completion slots, queue nodes and coroutine frames.
+// On Windows, coroutine frames belong to corsl's promise types, so the count is not checked there.
+CRPC_TEST(steady_state_calls_do_not_allocate)
+{
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+
+	crpc::connection<transport_t, crpc::server_of<AllocationCalc>> server;
+	server.set_implementation({ .sum = [](int a, int b) -> corsl::future<int> { co_return a + b; } });
+	server.start(std::move(server_transport));
+	crpc::connection<transport_t, crpc::client_of<AllocationCalc>> client{ std::move(client_transport) };
+
+	[[maybe_unused]] const auto count = corsl::block_wait(steady_state_allocations(client, 5000));
+#if !defined(_WIN32)
+	CHECK(count == 0);
+#endif
+}
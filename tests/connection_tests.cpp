@@ -0,0 +1,353 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+struct RestartCalc
+{
+	crpc::method<corsl::future<int>(int a, int b)> sum;
+};
+
+BOOST_DESCRIBE_STRUCT(RestartCalc, (), (sum));
+
+struct DirectCalc
+{
+	crpc::method<corsl::future<int>(int a, int b)> sum;
+	crpc::method<void(int value)> record;
+	crpc::method<corsl::future<>(HRESULT code)> fail;
+	crpc::method<corsl::future<bool>(std::thread::id caller), crpc::execution::pool_policy> runs_elsewhere;
+};
+
+BOOST_DESCRIBE_STRUCT(DirectCalc, (), (sum, record, fail, runs_elsewhere));
+
+struct HeldCalc
+{
+	crpc::method<corsl::future<int>(int value)> echo;
+};
+
+BOOST_DESCRIBE_STRUCT(HeldCalc, (), (echo));
+
+namespace
+{
+	using transport_t = crpc::transports::loopback::loopback_transport;
+	using client_t = crpc::connection<transport_t, crpc::client_of<RestartCalc>>;
+	using server_t = crpc::connection<transport_t, crpc::server_of<RestartCalc>>;
+
+	corsl::future<int> call_sum(client_t &client, int a, int b)
+	{
+		co_return co_await client.sum(a, b);
+	}
+
+	corsl::future<std::vector<crpc::details::message_t>> take(crpc::details::write_queue &queue)
+	{
+		std::vector<crpc::details::message_t> batch;
+		co_await queue.take(batch);
+		co_return batch;
+	}
+
+	corsl::future<HRESULT> call_fail(crpc::connection<transport_t, crpc::client_of<DirectCalc>> &client, HRESULT code)
+	{
+		try
+		{
+			co_await client.fail(code);
+		}
+		catch (const corsl::hresult_error &e)
+		{
+			co_return e.code();
+		}
+		co_return S_OK;
+	}
+
+	corsl::future<bool> call_runs_elsewhere(crpc::connection<transport_t, crpc::client_of<DirectCalc>> &client)
+	{
+		co_return co_await client.runs_elsewhere(std::this_thread::get_id());
+	}
+
+	// Requests held by the server until the test releases them
+	struct held_requests
+	{
+		std::mutex lock;
+		std::vector<std::pair<int, std::unique_ptr<corsl::promise<int>>>> requests;
+		std::atomic<size_t> arrived;
+
+		void wait_for(size_t count)
+		{
+			for (auto current = arrived.load(); current < count; current = arrived.load())
+				arrived.wait(current);
+		}
+
+		// Completes the held requests newest first, so responses come back in the reverse order of the calls
+		void release()
+		{
+			std::scoped_lock l{ lock };
+			for (auto it = requests.rbegin(); it != requests.rend(); ++it)
+				it->second->set(it->first);
+			requests.clear();
+			arrived = 0;
+		}
+	};
+
+	corsl::future<int> hold_echo(held_requests &held, int value)
+	{
+		auto &promise = [&]() -> corsl::promise<int> &
+			{
+				std::scoped_lock l{ held.lock };
+				return *held.requests.emplace_back(value, std::make_unique<corsl::promise<int>>()).second;
+			}();
+		auto future = promise.get_future();
+		held.arrived.fetch_add(1);
+		held.arrived.notify_all();
+		co_return co_await std::move(future);
+	}
+
+	// Returns -1 if the call fails
+	corsl::future<int> call_echo(crpc::connection<transport_t, crpc::client_of<HeldCalc>> &client, int value)
+	{
+		try
+		{
+			co_return co_await client.echo(value);
+		}
+		catch (...)
+		{
+			co_return -1;
+		}
+	}
+
+	void start_server(server_t &server, transport_t &&transport)
+	{
+		server.set_implementation({
+			.sum = [](int a, int b) -> corsl::future<int>
+			{
+				co_return a + b;
+			}
+		});
+		server.start(std::move(transport));
+	}
+}
+
+CRPC_TEST(write_queue_reset_drops_messages_and_cancellation)
+{
+	crpc::details::write_queue queue;
+	queue.push(crpc::details::message_t{ crpc::details::message_header{ 1, crpc::details::call_type::request, {} }, {} });
+	queue.cancel();
+	queue.reset();
+
+	queue.push(crpc::details::message_t{ crpc::details::message_header{ 2, crpc::details::call_type::request, {} }, {} });
+	auto batch = corsl::block_wait(take(queue));
+	CHECK(batch.size() == 1);
+	CHECK(!batch.empty() && batch.front().call_id == 2);
+}
+
+CRPC_TEST(write_queue_drops_pushes_once_closed)
+{
+	crpc::details::write_queue queue;
+	CHECK(queue.push(crpc::details::message_t{ crpc::details::message_header{ 1, crpc::details::call_type::request, {} }, {} }));
+	queue.close();
+	CHECK(!queue.push(crpc::details::message_t{ crpc::details::message_header{ 2, crpc::details::call_type::request, {} }, {} }));
+
+	// reset drops the message queued before the close and opens the queue again
+	queue.reset();
+	CHECK(queue.push(crpc::details::message_t{ crpc::details::message_header{ 3, crpc::details::call_type::request, {} }, {} }));
+	auto batch = corsl::block_wait(take(queue));
+	CHECK(batch.size() == 1);
+	CHECK(!batch.empty() && batch.front().call_id == 3);
+}
+
+CRPC_TEST(client_restarts_on_new_transport)
+{
+	client_t client;
+	{
+		auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+		server_t server;
+		start_server(server, std::move(server_transport));
+		client.start(std::move(client_transport));
+		CHECK(corsl::block_wait(call_sum(client, 1, 2)) == 3);
+		client.stop();
+	}
+
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+	server_t server;
+	start_server(server, std::move(server_transport));
+	client.start(std::move(client_transport));
+	CHECK(corsl::block_wait(call_sum(client, 40, 2)) == 42);
+}
+
+CRPC_TEST(inline_budget_starts_over_on_each_read)
+{
+	crpc::details::completion_budget<crpc::with_inline_completion<2, 1000000>> budget;
+	std::vector<bool> inline_completions;
+	const auto complete = [&]
+		{
+			budget.complete([&](auto is_inline)
+				{
+					inline_completions.push_back(decltype(is_inline)::value);
+				});
+		};
+
+	// a single read delivering three responses
+	complete();
+	complete();
+	complete();
+	CHECK(inline_completions == std::vector{ true, true, false });
+
+	// every following read carries one response
+	inline_completions.clear();
+	for (int i = 0; i < 5; ++i)
+	{
+		budget.reset();
+		complete();
+	}
+	CHECK(inline_completions == std::vector<bool>(5, true));
+}
+
+CRPC_TEST(direct_calls_reach_the_implementation)
+{
+	int recorded{};
+	crpc::connection<transport_t, crpc::server_of<DirectCalc>> server;
+	server.set_implementation({
+		.sum = [](int a, int b) -> corsl::future<int>
+		{
+			co_return a + b;
+		},
+		.record = [&](int value)
+		{
+			recorded = value;
+		},
+		.fail = [](HRESULT code) -> corsl::future<>
+		{
+			if (code)
+				corsl::throw_error(code);
+			throw std::runtime_error{ "not an hresult_error" };
+		},
+		.runs_elsewhere = [](std::thread::id caller) -> corsl::future<bool>
+		{
+			co_return std::this_thread::get_id() != caller;
+		}
+	});
+
+	crpc::connection<transport_t, crpc::client_of<DirectCalc>> client;
+	client.start_direct(server);
+
+	CHECK(corsl::block_wait(client.sum(40, 2)) == 42);
+
+	// a fire-and-forget method with the default policy runs before the call returns
+	client.record(7);
+	CHECK(recorded == 7);
+
+	// hresult_error crosses the direct boundary as it is, any other exception as E_FAIL
+	CHECK(corsl::block_wait(call_fail(client, E_INVALIDARG)) == E_INVALIDARG);
+	CHECK(corsl::block_wait(call_fail(client, 0)) == E_FAIL);
+
+	// the method's execution policy still applies
+	CHECK(corsl::block_wait(call_runs_elsewhere(client)));
+
+	client.stop();
+}
+
+CRPC_TEST(completion_table_overflows_and_rejects_stale_ids)
+{
+	constexpr const uint32_t count = 2500;
+	crpc::details::completion_table table;
+	std::vector<crpc::details::completion_table::promise_t> promises(count);
+
+	// more calls than slots: ids from 1024 on find their slot taken and go to the overflow map
+	for (uint32_t id = 0; id < count; ++id)
+		table.add(id, promises[id]);
+
+	// a response for an id sharing a slot with a pending call does not claim it, nor does a repeated one
+	CHECK(table.take(count) == nullptr);
+	CHECK(table.take(5) == &promises[5]);
+	CHECK(table.take(5) == nullptr);
+	CHECK(table.take(5 + 1024) == &promises[5 + 1024]);
+
+	// a call cancelled by its caller frees its slot for a newer call, whose generation a late response does not match
+	CHECK(table.take(7) == &promises[7]);
+	crpc::details::completion_table::promise_t newer;
+	table.add(7 + 4 * 1024, newer);
+	CHECK(table.take(7) == nullptr);
+	CHECK(table.take(7 + 4 * 1024) == &newer);
+
+	bool routed = true;
+	for (uint32_t id = count; id-- > 0;)
+	{
+		if (id != 5 && id != 5 + 1024 && id != 7)
+			routed = routed && table.take(id) == &promises[id];
+	}
+	CHECK(routed);
+
+	size_t left = 0;
+	table.take_all([&](auto &)
+		{
+			++left;
+		});
+	CHECK(left == 0);
+}
+
+CRPC_TEST(responses_reach_their_callers_beyond_table_capacity)
+{
+	constexpr const int count = 1500;
+	held_requests held;
+	crpc::connection<transport_t, crpc::client_of<HeldCalc>> client;
+
+	const auto start = [&](crpc::connection<transport_t, crpc::server_of<HeldCalc>> &server)
+		{
+			auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+			server.set_implementation({
+				.echo = [&](int value)
+				{
+					return hold_echo(held, value);
+				}
+			});
+			server.start(std::move(server_transport));
+			client.start(std::move(client_transport));
+		};
+
+	const auto call_all = [&](int base)
+		{
+			std::vector<corsl::future<int>> calls;
+			calls.reserve(count);
+			for (int i = 0; i < count; ++i)
+				calls.push_back(call_echo(client, base + i));
+			held.wait_for(count);
+			return calls;
+		};
+
+	const auto check_routed = [&](std::vector<corsl::future<int>> &calls, int base)
+		{
+			bool routed = true;
+			for (int i = 0; i < count; ++i)
+				routed = routed && corsl::block_wait(std::move(calls[i])) == base + i;
+			CHECK(routed);
+		};
+
+	{
+		crpc::connection<transport_t, crpc::server_of<HeldCalc>> server;
+		start(server);
+
+		// every call is in flight at once, responses come back newest first
+		auto calls = call_all(0);
+		held.release();
+		check_routed(calls, 0);
+
+		// stopping the client fails the calls in flight, wherever they are in the table
+		calls = call_all(count);
+		client.stop();
+		bool failed = true;
+		for (auto &call : calls)
+			failed = failed && corsl::block_wait(std::move(call)) == -1;
+		CHECK(failed);
+		held.release();
+	}
+
+	// later calls reuse the slots with new ids, responses still reach their callers
+	crpc::connection<transport_t, crpc::server_of<HeldCalc>> server;
+	start(server);
+	auto calls = call_all(2 * count);
+	held.release();
+	check_routed(calls, 2 * count);
+}
@@ -0,0 +1,168 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+struct busy_executor;
+
+struct BusyCalc
+{
+	crpc::method<int(int), crpc::execution::executor_policy<busy_executor, 1, 1>> hold;
+};
+
+BOOST_DESCRIBE_STRUCT(BusyCalc, (), (hold));
+
+namespace
+{
+	using transport_t = crpc::transports::loopback::loopback_transport;
+
+	std::atomic<int> started;
+	std::atomic<bool> released;
+
+	int hold(int value)
+	{
+		started.fetch_add(1);
+		started.notify_all();
+		released.wait(false);
+		return value;
+	}
+
+	corsl::future<HRESULT> overflow(crpc::connection<transport_t, crpc::client_of<BusyCalc>> &client, int &sum)
+	{
+		auto running = client.hold(1);
+		started.wait(0);
+
+		// the only thread is busy: the next request fills the queue and the one after it is rejected
+		auto queued = client.hold(2);
+		auto rejected = client.hold(3);
+
+		HRESULT result = S_OK;
+		try
+		{
+			co_await std::move(rejected);
+		}
+		catch (const corsl::hresult_error &e)
+		{
+			result = e.code();
+		}
+
+		released = true;
+		released.notify_all();
+		sum = co_await std::move(running) + co_await std::move(queued);
+		co_return result;
+	}
+
+	corsl::fire_and_forget run_on(crpc::details::bounded_executor &executor, std::atomic<int> &ran)
+	{
+		co_await executor.schedule();
+		ran.fetch_add(1);
+	}
+
+#if !defined(_WIN32)
+	// Posts `count` tasks to the queue of the worker that runs it and blocks that worker until all of them have run,
+	// so every task has to be stolen by the other workers
+	void flood_one_worker(crpc::posix::thread_pool &pool, std::vector<std::atomic<int>> &runs, std::atomic<size_t> &ran)
+	{
+		std::atomic<bool> flooded;
+		pool.post([&]
+			{
+				for (auto &run : runs)
+				{
+					pool.post([&]
+						{
+							run.fetch_add(1);
+							ran.fetch_add(1);
+							ran.notify_all();
+						});
+				}
+				for (auto done = ran.load(); done != runs.size(); done = ran.load())
+					ran.wait(done);
+				flooded = true;
+				flooded.notify_all();
+			});
+		flooded.wait(false);
+	}
+#endif
+}
+
+CRPC_TEST(full_executor_rejects_requests)
+{
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+
+	crpc::connection<transport_t, crpc::server_of<BusyCalc>> server;
+	server.set_implementation({ .hold = hold });
+	server.start(std::move(server_transport));
+	crpc::connection<transport_t, crpc::client_of<BusyCalc>> client{ std::move(client_transport) };
+
+	int sum{};
+	CHECK(corsl::block_wait(overflow(client, sum)) == crpc::execution::executor_busy);
+	CHECK(sum == 3);
+}
+
+CRPC_TEST(bounded_executor_runs_queued_work_before_joining)
+{
+	std::atomic<int> ran;
+	{
+		crpc::details::bounded_executor executor{ 2, 64 };
+		for (int i = 0; i < 32; ++i)
+			run_on(executor, ran);
+	}
+	CHECK(ran == 32);
+}
+
+#if !defined(_WIN32)
+CRPC_TEST(idle_workers_steal_from_a_flooded_worker)
+{
+	std::vector<std::atomic<int>> runs(1000);
+	std::atomic<size_t> ran;
+	{
+		crpc::posix::thread_pool pool{ 4 };
+		flood_one_worker(pool, runs, ran);
+
+		const auto stats = pool.stats();
+		CHECK(stats.steals >= runs.size());
+		CHECK(std::ranges::all_of(stats.queue_depths, [](size_t depth) { return depth == 0; }));
+	}
+	CHECK(std::ranges::all_of(runs, [](const std::atomic<int> &run) { return run == 1; }));
+}
+
+CRPC_TEST(worker_mixes_newest_first_with_oldest_tasks)
+{
+	constexpr const int count = 64;
+	constexpr const auto streak = crpc::posix::thread_pool::max_lifo_streak;
+	std::vector<int> order;
+	std::atomic<bool> done;
+	{
+		crpc::posix::thread_pool pool{ 1 };
+		pool.post([&]
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					pool.post([&, i]
+						{
+							order.push_back(i);
+							if (order.size() == count)
+							{
+								done = true;
+								done.notify_all();
+							}
+						});
+				}
+			});
+		done.wait(false);
+	}
+
+	// the newest task runs first, the oldest is not starved behind the rest of the streak
+	CHECK(order.front() == count - 1);
+	const auto oldest = std::ranges::find(order, 0) - order.begin();
+	CHECK(oldest > 0 && oldest <= static_cast<std::ptrdiff_t>(streak));
+	std::vector<int> sorted = order;
+	std::ranges::sort(sorted);
+	CHECK(std::ranges::equal(sorted, std::views::iota(0, count)));
+}
+#endif
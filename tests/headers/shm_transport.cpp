@@ -0,0 +1,13 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+// Checks that the header compiles when it is the only one included.
+// On Windows, transport headers expect <Windows.h> to be included first.
+#if !defined(_WIN32)
+#include <crpc/shm_transport.h>
+#endif
@@ -0,0 +1,20 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+int main()
+{
+	for (const auto &test : crpc_tests::registry())
+	{
+		const auto before = crpc_tests::failures;
+		test.run();
+		std::printf("%s: %s\n", test.name, before == crpc_tests::failures ? "passed" : "FAILED");
+	}
+	return crpc_tests::failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+struct SyncCalc
+{
+	crpc::method<int(int a, int b)> sum;
+};
+
+BOOST_DESCRIBE_STRUCT(SyncCalc, (), (sum));
+
+struct ViewCalc
+{
+	// the elements of `values` follow a 32-bit length at the start of the payload, so they are 4-byte aligned
+	crpc::method<corsl::future<int>(std::span<const int> values, std::string_view text)> aligned;
+	// a leading byte puts the elements at an odd offset
+	crpc::method<corsl::future<int>(uint8_t tag, std::span<const int> values, std::string_view text)> misaligned;
+};
+
+BOOST_DESCRIBE_STRUCT(ViewCalc, (), (aligned, misaligned));
+
+namespace
+{
+	struct value_handler
+	{
+		int operator()(int a, int b) const
+		{
+			return a + b;
+		}
+	};
+
+	struct future_handler
+	{
+		corsl::future<int> operator()(int a, int b) const;
+	};
+
+	// the implementation of a synchronous method must return the value, a future-returning callable is rejected
+	static_assert(std::constructible_from<crpc::method<int(int, int)>, value_handler>);
+	static_assert(!std::constructible_from<crpc::method<int(int, int)>, future_handler>);
+	static_assert(std::constructible_from<crpc::method<corsl::future<int>(int, int)>, future_handler>);
+
+	using transport_t = crpc::transports::loopback::loopback_transport;
+
+	corsl::future<int> call_sum(crpc::connection<transport_t, crpc::client_of<SyncCalc>> &client)
+	{
+		co_return co_await client.sum(40, 2);
+	}
+
+	// A loopback transport that remembers the payload of the last message it has read
+	class recording_transport : public transport_t
+	{
+		std::shared_ptr<std::span<const std::byte>> last_payload;
+
+	public:
+		recording_transport() = default;
+		recording_transport(transport_t &&transport, std::shared_ptr<std::span<const std::byte>> last_payload) :
+			transport_t{ std::move(transport) },
+			last_payload{ std::move(last_payload) }
+		{}
+
+		corsl::future<crpc::details::message_t> read()
+		{
+			auto message = co_await transport_t::read();
+			*last_payload = message.payload;
+			co_return message;
+		}
+	};
+
+	const std::vector<int> view_values{ 1, 2, 3, 5, 8, 13, 21 };
+	constexpr const std::string_view view_text{ "viewed in place" };
+
+	// view flags reported by the server
+	constexpr const int values_match = 1;
+	constexpr const int text_matches = 2;
+	constexpr const int values_in_payload = 4;
+	constexpr const int text_in_payload = 8;
+
+	template<class T>
+	bool points_into(std::span<const std::byte> payload, std::span<const T> view)
+	{
+		const auto bytes = std::as_bytes(view);
+		return bytes.data() >= payload.data() && bytes.data() + bytes.size() <= payload.data() + payload.size();
+	}
+
+	corsl::future<int> check_views(std::span<const std::byte> payload, std::span<const int> values, std::string_view text)
+	{
+		// the views stay valid until the method completes, not only until its first suspension
+		co_await corsl::resume_background();
+		int flags{};
+		if (std::ranges::equal(values, view_values))
+			flags |= values_match;
+		if (text == view_text)
+			flags |= text_matches;
+		if (points_into(payload, values))
+			flags |= values_in_payload;
+		if (points_into(payload, std::span{ text }))
+			flags |= text_in_payload;
+		co_return flags;
+	}
+
+	corsl::future<int> call_aligned(crpc::connection<transport_t, crpc::client_of<ViewCalc>> &client)
+	{
+		co_return co_await client.aligned(view_values, view_text);
+	}
+
+	corsl::future<int> call_misaligned(crpc::connection<transport_t, crpc::client_of<ViewCalc>> &client)
+	{
+		co_return co_await client.misaligned(uint8_t{ 1 }, view_values, view_text);
+	}
+}
+
+CRPC_TEST(sync_method_runs_handler)
+{
+	crpc::method<int(int, int)> sum{ value_handler{} };
+	CHECK(static_cast<bool>(sum.handler));
+
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+
+	crpc::connection<transport_t, crpc::server_of<SyncCalc>> server;
+	server.set_implementation({ .sum = value_handler{} });
+	server.start(std::move(server_transport));
+	crpc::connection<transport_t, crpc::client_of<SyncCalc>> client{ std::move(client_transport) };
+
+	CHECK(corsl::block_wait(call_sum(client)) == 42);
+}
+
+CRPC_TEST(server_views_borrow_from_the_request_payload)
+{
+	auto last_payload = std::make_shared<std::span<const std::byte>>();
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+
+	crpc::connection<recording_transport, crpc::server_of<ViewCalc>> server;
+	server.set_implementation({
+		.aligned = [last_payload](std::span<const int> values, std::string_view text)
+		{
+			return check_views(*last_payload, values, text);
+		},
+		.misaligned = [last_payload](uint8_t, std::span<const int> values, std::string_view text)
+		{
+			return check_views(*last_payload, values, text);
+		}
+	});
+	server.start(recording_transport{ std::move(server_transport), last_payload });
+	crpc::connection<transport_t, crpc::client_of<ViewCalc>> client{ std::move(client_transport) };
+
+	CHECK(corsl::block_wait(call_aligned(client)) == (values_match | text_matches | values_in_payload | text_in_payload));
+	// misaligned elements are copied, the characters are still viewed in place
+	CHECK(corsl::block_wait(call_misaligned(client)) == (values_match | text_matches | text_in_payload));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#if defined(_WIN32)
+// Windows
+#define WIN32_LEAN_AND_MEAN
+#define STRICT
+#include <Windows.h>
+#endif
+
+// stl
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <atomic>
+#include <cstdio>
+
+// crpc
+#include <crpc/connection.h>
+#include <crpc/loopback_transport.h>
+
+#include "test.h"
+
+using namespace std::literals;
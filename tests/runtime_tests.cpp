@@ -0,0 +1,48 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+#if !defined(_WIN32)
+namespace
+{
+	corsl::future<int> answer_on_pool()
+	{
+		co_await corsl::resume_background();
+		co_return 42;
+	}
+
+	// Blocks every worker of the background pool in block_wait on work that needs a pool thread to run
+	void block_every_worker()
+	{
+		auto &pool = crpc::posix::background_pool();
+		const auto count = pool.size();
+		auto answered = std::make_shared<std::atomic<size_t>>();
+		for (size_t i = 0; i < count; ++i)
+		{
+			pool.post([answered]
+				{
+					if (corsl::block_wait(answer_on_pool()) == 42)
+					{
+						answered->fetch_add(1);
+						answered->notify_all();
+					}
+				});
+		}
+		for (auto current = answered->load(); current != count; current = answered->load())
+			answered->wait(current);
+	}
+}
+
+CRPC_TEST(block_wait_on_every_pool_thread_completes)
+{
+	block_every_worker();
+	// the second round is served by the spare threads kept from the first one
+	block_every_worker();
+}
+#endif
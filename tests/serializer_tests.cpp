@@ -0,0 +1,167 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+struct span_point
+{
+	int x;
+	int y;
+};
+
+BOOST_DESCRIBE_STRUCT(span_point, (), (x, y));
+
+// a and b, then c and d, are adjacent and copied as runs; name and values are written element by element
+struct mixed_record
+{
+	int a;
+	int b;
+	std::string name;
+	int c;
+	int d;
+	std::vector<int> values;
+};
+
+BOOST_DESCRIBE_STRUCT(mixed_record, (), (a, b, name, c, d, values));
+
+// trivially copyable, but the padding after tag must not be written
+struct padded_record
+{
+	char tag;
+	int value;
+};
+
+BOOST_DESCRIBE_STRUCT(padded_record, (), (tag, value));
+
+// custom serialization that only accepts a regular writer
+struct counted_record
+{
+	int value;
+
+	static inline int writes{};
+
+	void serialize_write(crpc::Writer<> &w) const
+	{
+		++writes;
+		w << value;
+	}
+};
+
+struct SpanCalc
+{
+	crpc::method<corsl::future<int>(std::span<const span_point> points)> sum;
+};
+
+BOOST_DESCRIBE_STRUCT(SpanCalc, (), (sum));
+
+namespace
+{
+	using transport_t = crpc::transports::loopback::loopback_transport;
+	using state_t = crpc::with_serializer_state<crpc::compact_encoding>;
+
+	template<class T, class State>
+	T read_back(const crpc::details::payload_t &payload, State &state)
+	{
+		T result{};
+		crpc::Reader reader{ std::span<const std::byte>{ payload }, state };
+		reader >> result;
+		return result;
+	}
+
+	corsl::future<int> call_sum(crpc::connection<transport_t, crpc::client_of<SpanCalc>, state_t> &client, std::span<const span_point> points)
+	{
+		co_return co_await client.sum(points);
+	}
+}
+
+// compact encoding writes the members of such structs as varints, so the server cannot view them in place
+CRPC_TEST(compact_span_of_structs_round_trips)
+{
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+
+	crpc::connection<transport_t, crpc::server_of<SpanCalc>, state_t> server;
+	server.set_implementation({ .sum = [](std::span<const span_point> points) -> corsl::future<int>
+		{
+			int result{};
+			for (const auto &point : points)
+				result += point.x + point.y;
+			co_return result;
+		} });
+	server.start(std::move(server_transport));
+	crpc::connection<transport_t, crpc::client_of<SpanCalc>, state_t> client{ std::move(client_transport) };
+
+	const std::vector<span_point> points{ { 1, 2 }, { 1000, -300 }, { 4000, 4309 } };
+	CHECK(corsl::block_wait(call_sum(client, points)) == 9012);
+}
+
+CRPC_TEST(mixed_struct_round_trips)
+{
+	const mixed_record record{ 1, 2, "name"s, 3, 4, { 5, 6, 7 } };
+	crpc::details::empty_serializer_state state;
+	const auto payload = crpc::create_writer(record).get();
+	CHECK(payload.size() == 2 * sizeof(int) + sizeof(uint32_t) + 4 + 2 * sizeof(int) + sizeof(uint32_t) + 3 * sizeof(int));
+
+	const auto result = read_back<mixed_record>(payload, state);
+	CHECK(result.a == 1 && result.b == 2 && result.c == 3 && result.d == 4);
+	CHECK(result.name == "name"s);
+	CHECK(result.values == std::vector{ 5, 6, 7 });
+
+	const auto padded = crpc::create_writer(padded_record{ 'x', 42 }).get();
+	CHECK(padded.size() == sizeof(char) + sizeof(int));
+	const auto padded_result = read_back<padded_record>(padded, state);
+	CHECK(padded_result.tag == 'x' && padded_result.value == 42);
+}
+
+CRPC_TEST(serialized_size_matches_writer)
+{
+	const mixed_record record{ -1, 300, "a longer name"s, 70000, 0, { 1, -2, 3000000 } };
+	const std::vector<padded_record> padded{ { 'a', 1 }, { 'b', 2 } };
+	const std::optional<std::string> text{ "text"s };
+
+	CHECK(crpc::serialized_size(record, padded, text) == crpc::create_writer(record, padded, text).get().size());
+
+	crpc::compact_encoding compact;
+	CHECK(crpc::serialized_size_with_state(compact, record, padded, text) == crpc::create_writer_with_state(compact, record, padded, text).get().size());
+
+	crpc::aligned_framing<16> aligned;
+	CHECK(crpc::serialized_size_with_state(aligned, uint8_t{ 1 }, record, text) == crpc::create_writer_with_state(aligned, uint8_t{ 1 }, record, text).get().size());
+}
+
+CRPC_TEST(aligned_framing_pads_arrays)
+{
+	crpc::aligned_framing<16> state;
+	const std::vector<int> values{ 1, 2, 3 };
+	const auto payload = crpc::create_writer_with_state(state, uint8_t{ 7 }, values).get();
+
+	// tag at 0, length at 1, padding up to 16, then the elements
+	CHECK(payload.size() == 16 + values.size() * sizeof(int));
+	CHECK(std::memcmp(payload.data() + 16, values.data(), values.size() * sizeof(int)) == 0);
+
+	crpc::Reader reader{ std::span<const std::byte>{ payload }, state };
+	uint8_t tag{};
+	crpc::details::borrowed_view<std::span<const int>> view;
+	reader >> tag >> view;
+	const std::span<const int> elements = view;
+	CHECK(tag == 7);
+	CHECK(std::ranges::equal(elements, values));
+	CHECK(reinterpret_cast<const std::byte *>(elements.data()) == payload.data() + 16);
+}
+
+CRPC_TEST(payload_is_reserved_only_when_cheap_to_size)
+{
+	static_assert(crpc::Writer<>::sized_up_front<int, std::string, std::vector<int>, mixed_record, std::optional<padded_record>>());
+	static_assert(!crpc::Writer<>::sized_up_front<std::vector<std::string>>());
+	static_assert(!crpc::Writer<>::sized_up_front<int, counted_record>());
+	static_assert(!crpc::Writer<crpc::compact_encoding>::sized_up_front<std::vector<int>>());
+
+	// a custom serializer runs once per payload: it is not run again to measure it
+	counted_record::writes = 0;
+	const auto payload = crpc::create_writer(1, counted_record{ 42 }).get();
+	CHECK(counted_record::writes == 1);
+	CHECK(payload.size() == 2 * sizeof(int));
+}
@@ -0,0 +1,53 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+namespace crpc_tests
+{
+	struct test_case
+	{
+		const char *name;
+		void (*run)();
+	};
+
+	inline std::vector<test_case> &registry()
+	{
+		static std::vector<test_case> tests;
+		return tests;
+	}
+
+	inline int failures{};
+
+	struct registrar
+	{
+		registrar(const char *name, void (*run)())
+		{
+			registry().push_back({ name, run });
+		}
+	};
+
+	inline void check(bool condition, const char *expression, const char *file, int line)
+	{
+		if (!condition)
+		{
+			++failures;
+			std::fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+		}
+	}
+}
+
+#define CRPC_TEST(name) \
+	static void name(); \
+	static const crpc_tests::registrar name##_registrar{ #name, name }; \
+	static void name()
+
+#define CHECK(...) crpc_tests::check(static_cast<bool>(__VA_ARGS__), #__VA_ARGS__, __FILE__, __LINE__)
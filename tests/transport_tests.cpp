@@ -0,0 +1,421 @@
+//-------------------------------------------------------------------------------------------------------
+// AsyncCppRpc - Light-weight asynchronous transport-agnostic C++ RPC library
+// Copyright (C) 2022 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "pch.h"
+
+#if !defined(_WIN32)
+#include <crpc/tcp_transport.h>
+#include <crpc/uring_transport.h>
+#include <crpc/unix_transport.h>
+#include <crpc/shm_transport.h>
+
+#include <unistd.h>
+#endif
+
+#include <numeric>
+
+struct TransportCalc
+{
+	crpc::method<corsl::future<int>(int a, int b)> sum;
+	crpc::method<corsl::future<std::vector<int>>(const std::vector<int> &values)> echo;
+};
+
+BOOST_DESCRIBE_STRUCT(TransportCalc, (), (sum, echo));
+
+struct BatchCalc
+{
+	crpc::method<void(int index, const std::vector<int> &padding)> record;
+};
+
+BOOST_DESCRIBE_STRUCT(BatchCalc, (), (record));
+
+namespace
+{
+	// large enough to span several socket reads and a shared memory ring
+	constexpr const size_t large_count = 200 * 1024;
+
+	// the limits of a single batched write of a connection
+	constexpr const size_t max_batch_count = 64;
+	constexpr const size_t max_batch_bytes = 256 * 1024;
+
+	struct write_log
+	{
+		// the first write waits for the gate, so the messages sent meanwhile pile up in the write queue
+		corsl::promise<> gate;
+		bool gated{ true };
+		std::vector<std::pair<size_t, size_t>> writes;	// messages and payload bytes of each write
+	};
+
+	// A batch-capable loopback transport that records every write
+	class counting_transport : public crpc::transports::loopback::loopback_transport
+	{
+		std::shared_ptr<write_log> log;
+
+		corsl::future<> wait_gate()
+		{
+			if (std::exchange(log->gated, false))
+				co_await log->gate.get_future();
+		}
+
+	public:
+		counting_transport() = default;
+		counting_transport(loopback_transport &&transport, std::shared_ptr<write_log> log) :
+			loopback_transport{ std::move(transport) },
+			log{ std::move(log) }
+		{}
+
+		corsl::future<> write(crpc::details::message_t message)
+		{
+			co_await wait_gate();
+			log->writes.emplace_back(1, message.payload.size());
+			co_await loopback_transport::write(std::move(message));
+		}
+
+		corsl::future<> write_batch(std::span<crpc::details::message_t> messages)
+		{
+			co_await wait_gate();
+			size_t bytes{};
+			for (const auto &message : messages)
+				bytes += message.payload.size();
+			log->writes.emplace_back(messages.size(), bytes);
+			for (auto &message : messages)
+				co_await loopback_transport::write(std::move(message));
+		}
+	};
+
+	static_assert(crpc::batch_transport<counting_transport>);
+
+	struct read_log
+	{
+		// the first read waits for the gate, so the messages sent meanwhile are all received by then
+		corsl::promise<> gate;
+		bool gated{ true };
+		std::atomic<size_t> sent;
+		size_t taken{};
+		std::vector<size_t> reads;	// messages delivered by each read_batch
+	};
+
+	// A loopback transport that delivers every message the other end has already written with a single read_batch
+	class batch_reading_transport : public crpc::transports::loopback::loopback_transport
+	{
+		std::shared_ptr<read_log> log;
+
+	public:
+		batch_reading_transport() = default;
+		batch_reading_transport(loopback_transport &&transport, std::shared_ptr<read_log> log) :
+			loopback_transport{ std::move(transport) },
+			log{ std::move(log) }
+		{}
+
+		corsl::future<> write(crpc::details::message_t message)
+		{
+			co_await loopback_transport::write(std::move(message));
+			log->sent.fetch_add(1);
+		}
+
+		corsl::future<> read_batch(std::vector<crpc::details::message_t> &messages)
+		{
+			if (std::exchange(log->gated, false))
+				co_await log->gate.get_future();
+
+			size_t count{};
+			do
+			{
+				auto message = co_await read();
+				messages.push_back(std::move(message));
+				++count;
+			} while (++log->taken < log->sent.load());
+			log->reads.push_back(count);
+		}
+	};
+
+	static_assert(crpc::details::concepts::batch_read_transport<batch_reading_transport>);
+
+	// Sends void calls from a client to a server over `ServerTransport` made by `make_server` and checks that they
+	// arrive in full and that the server's reads took several messages at once
+	template<class ServerTransport, class MakeServer>
+	void check_batched_reads(MakeServer &&make_server)
+	{
+		constexpr const int count = 200;
+		auto log = std::make_shared<read_log>();
+		std::atomic<int> received;
+		std::atomic<int64_t> index_sum;
+
+		auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+		crpc::connection<ServerTransport, crpc::server_of<BatchCalc>> server;
+		server.set_implementation({
+			.record = [&](int index, const std::vector<int> &)
+			{
+				index_sum.fetch_add(index);
+				received.fetch_add(1);
+				received.notify_all();
+			}
+		});
+		server.start(make_server(std::move(server_transport), log));
+
+		crpc::connection<batch_reading_transport, crpc::client_of<BatchCalc>> client;
+		client.start(batch_reading_transport{ std::move(client_transport), log });
+		for (int i = 0; i < count; ++i)
+			client.record(i, {});
+		for (auto current = log->sent.load(); current != count; current = log->sent.load())
+			std::this_thread::yield();
+		log->gate.set();
+
+		for (auto current = received.load(); current != count; current = received.load())
+			received.wait(current);
+		CHECK(index_sum == int64_t{ count } * (count - 1) / 2);
+
+		server.stop();
+		CHECK(std::accumulate(log->reads.begin(), log->reads.end(), size_t{}) == count);
+		CHECK(!log->reads.empty() && log->reads.front() == count);
+	}
+
+	template<class Transport>
+	corsl::future<int> call_sum(crpc::connection<Transport, crpc::client_of<TransportCalc>> &client, int a, int b)
+	{
+		co_return co_await client.sum(a, b);
+	}
+
+	template<class Transport>
+	corsl::future<std::vector<int>> call_echo(crpc::connection<Transport, crpc::client_of<TransportCalc>> &client, const std::vector<int> &values)
+	{
+		co_return co_await client.echo(values);
+	}
+
+	template<class Transport>
+	corsl::future<bool> call_fails(crpc::connection<Transport, crpc::client_of<TransportCalc>> &client)
+	{
+		try
+		{
+			co_await client.sum(1, 2);
+		}
+		catch (...)
+		{
+			co_return true;
+		}
+		co_return false;
+	}
+
+	// Makes calls over a connected pair of transports, then destroys the server end and checks that the client notices
+	template<class Transport>
+	void check_connection(Transport &&client_transport, Transport &&server_transport)
+	{
+		corsl::promise<> disconnected;
+		std::atomic_flag reported;
+
+		crpc::connection<Transport, crpc::client_of<TransportCalc>> client;
+		client.on_error([&](HRESULT, crpc::captured_on)
+			{
+				if (!reported.test_and_set())
+					disconnected.set_async();
+			});
+		client.start(std::move(client_transport));
+
+		{
+			crpc::connection<Transport, crpc::server_of<TransportCalc>> server;
+			server.set_implementation({
+				.sum = [](int a, int b) -> corsl::future<int>
+				{
+					co_return a + b;
+				},
+				.echo = [](const std::vector<int> &values) -> corsl::future<std::vector<int>>
+				{
+					co_return values;
+				}
+			});
+			server.start(std::move(server_transport));
+
+			CHECK(corsl::block_wait(call_sum(client, 40, 2)) == 42);
+
+			std::vector<int> values(large_count);
+			std::iota(values.begin(), values.end(), 0);
+			CHECK(corsl::block_wait(call_echo(client, values)) == values);
+			CHECK(corsl::block_wait(call_echo(client, std::vector<int>{})).empty());
+			// back-to-back large frames followed by small ones switch the socket transports between their receive modes
+			CHECK(corsl::block_wait(call_echo(client, values)) == values);
+			CHECK(corsl::block_wait(call_echo(client, values)) == values);
+			CHECK(corsl::block_wait(call_sum(client, 1, 2)) == 3);
+		}
+
+		corsl::block_wait(disconnected.get_future());
+		CHECK(corsl::block_wait(call_fails(client)));
+	}
+
+#if !defined(_WIN32)
+	template<class Transport, class Listener, class Config>
+	void check_transport(Listener &listener, const Config &config)
+	{
+		corsl::cancellation_source cancel;
+		auto accepted = listener.wait_client(cancel);
+		Transport client_transport;
+		corsl::block_wait(client_transport.connect(config));
+		check_connection(std::move(client_transport), corsl::block_wait(std::move(accepted)));
+	}
+
+	corsl::future<> accept_first(crpc::transports::tcp::tcp_listener &listener, const corsl::cancellation_source &cancel,
+		corsl::promise<crpc::transports::tcp::tcp_transport> &accepted, std::atomic_flag &taken)
+	{
+		try
+		{
+			auto transport = co_await listener.wait_client(cancel);
+			if (!taken.test_and_set())
+				accepted.set(std::move(transport));
+		}
+		catch (const corsl::operation_cancelled &)
+		{
+		}
+	}
+
+	std::string socket_name(std::string_view transport)
+	{
+		return "@crpc-tests-"s + std::string{ transport } + "-"s + std::to_string(::getpid());
+	}
+#endif
+}
+
+CRPC_TEST(loopback_transport_round_trips)
+{
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+	check_connection(std::move(client_transport), std::move(server_transport));
+}
+
+#if !defined(_WIN32)
+CRPC_TEST(tcp_transport_round_trips)
+{
+	using namespace crpc::transports::tcp;
+	tcp_listener listener;
+	const auto port = corsl::block_wait(listener.create_server());
+	check_transport<tcp_transport>(listener, config_t{ "127.0.0.1"s, static_cast<uint16_t>(port) });
+}
+
+// the kernel picks one of the SO_REUSEPORT listeners, the others are cancelled once a client is accepted
+CRPC_TEST(tcp_per_core_servers_accept_calls)
+{
+	using namespace crpc::transports::tcp;
+	auto listeners = tcp_listener::create_per_core_servers({ "127.0.0.1"s, 0 });
+	CHECK(listeners.size() == crpc::posix::per_core_reactors().size());
+
+	corsl::cancellation_source cancel;
+	corsl::promise<tcp_transport> accepted;
+	std::atomic_flag taken;
+	std::vector<corsl::future<>> accepts;
+	for (auto &listener : listeners)
+		accepts.push_back(accept_first(listener, cancel, accepted, taken));
+
+	tcp_transport client_transport;
+	corsl::block_wait(client_transport.connect({ "127.0.0.1"s, static_cast<uint16_t>(listeners.front().get_port()) }));
+	auto server_transport = corsl::block_wait(accepted.get_future());
+	CHECK(server_transport.get_executor());
+
+	cancel.cancel();
+	for (auto &accept : accepts)
+		corsl::block_wait(std::move(accept));
+
+	check_connection(std::move(client_transport), std::move(server_transport));
+}
+
+// falls back to tcp_transport where io_uring is not available
+CRPC_TEST(uring_transport_round_trips)
+{
+	using namespace crpc::transports::uring;
+	uring_listener listener;
+	const auto port = corsl::block_wait(listener.create_server());
+	check_transport<uring_transport>(listener, config_t{ "127.0.0.1"s, static_cast<uint16_t>(port) });
+}
+
+CRPC_TEST(unix_transport_round_trips)
+{
+	using namespace crpc::transports::unix_socket;
+	unix_listener listener;
+	const config_t config{ socket_name("unix") };
+	corsl::block_wait(listener.create_server(config));
+	check_transport<unix_transport>(listener, config);
+}
+
+CRPC_TEST(shm_transport_round_trips)
+{
+	using namespace crpc::transports::shm;
+	shm_listener listener;
+	const config_t config{ socket_name("shm"), 64 * 1024 };
+	corsl::block_wait(listener.create_server(config));
+	check_transport<shm_transport>(listener, config);
+}
+#endif
+
+CRPC_TEST(writer_batches_queued_messages_within_limits)
+{
+	constexpr const int count = 600;
+	auto log = std::make_shared<write_log>();
+	std::atomic<int> received;
+	std::atomic<int64_t> index_sum;
+
+	auto [client_transport, server_transport] = crpc::transports::loopback::create_pair();
+	crpc::connection<crpc::transports::loopback::loopback_transport, crpc::server_of<BatchCalc>> server;
+	server.set_implementation({
+		.record = [&](int index, const std::vector<int> &)
+		{
+			index_sum.fetch_add(index);
+			received.fetch_add(1);
+			received.notify_all();
+		}
+	});
+	server.start(std::move(server_transport));
+
+	crpc::connection<counting_transport, crpc::client_of<BatchCalc>> client;
+	client.start(counting_transport{ std::move(client_transport), log });
+
+	// every 25th message carries 100 KB, so only two of them fit in a batch
+	const std::vector<int> large(25000);
+	for (int i = 0; i < count; ++i)
+		client.record(i, i % 25 ? std::vector<int>{} : large);
+	log->gate.set();
+
+	for (auto current = received.load(); current != count; current = received.load())
+		received.wait(current);
+	CHECK(index_sum == int64_t{ count } * (count - 1) / 2);
+
+	client.stop();
+	size_t messages{};
+	bool within_limits = true;
+	for (const auto &[batch_count, bytes] : log->writes)
+	{
+		messages += batch_count;
+		within_limits = within_limits && batch_count <= max_batch_count && (batch_count == 1 || bytes <= max_batch_bytes);
+	}
+	CHECK(messages == count);
+	CHECK(log->writes.size() < count / 4);
+	CHECK(within_limits);
+}
+
+CRPC_TEST(reader_takes_whole_batches)
+{
+	check_batched_reads<batch_reading_transport>([](crpc::transports::loopback::loopback_transport &&transport, std::shared_ptr<read_log> log)
+		{
+			return batch_reading_transport{ std::move(transport), std::move(log) };
+		});
+}
+
+CRPC_TEST(dynamic_transport_forwards_batched_reads)
+{
+	check_batched_reads<crpc::dynamic_transport>([](crpc::transports::loopback::loopback_transport &&transport, std::shared_ptr<read_log> log)
+		{
+			return crpc::dynamic_transport{ std::make_shared<crpc::details::dynamic_transport_impl<batch_reading_transport>>(std::move(transport), std::move(log)) };
+		});
+
+	// a transport without read_batch delivers one message per read through the dynamic wrapper
+	auto channel = std::make_shared<crpc::details::loopback::loopback_channel>();
+	crpc::transports::loopback::loopback_transport sender{ channel, 0 };
+	crpc::dynamic_transport receiver{ std::make_shared<crpc::details::dynamic_transport_impl<crpc::transports::loopback::loopback_transport>>(channel, 1u) };
+	for (uint32_t id = 1; id <= 3; ++id)
+		corsl::block_wait(sender.write(crpc::details::message_t{ crpc::details::message_header{ id, crpc::details::call_type::void_request, {} }, {} }));
+
+	std::vector<crpc::details::message_t> messages;
+	corsl::block_wait(receiver.read_batch(messages));
+	corsl::block_wait(receiver.read_batch(messages));
+	CHECK(messages.size() == 2 && messages[0].call_id == 1 && messages[1].call_id == 2);
+}